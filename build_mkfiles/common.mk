@@ -1,29 +1,62 @@
 # common Makefile to use in the driver_* directories
 # 
 # the following variables need to be provided:
-# DTS_SRC - device tree source file
+# DTS_SRC - device tree source files
 # MOD_SRC - driver source file
-# TEST_SRC - name of the test application source file
+# TEST_SRC - names of the test application source files
+#
+# and optionally:
+# TEST_LDLIBS - libraries to link the test applications with
+# KUNIT_SRC - KUnit suites, built as modules for the UML kernel by `make kunit`
+# BENCH_CMD - command run by `make bench` on the emulated system, printing
+#             its results as JSON lines
+# BENCH_RESC - Renode script (relative to the driver directory) for the bench
+# BENCH_STIMULUS - monitor command started together with BENCH_CMD, which can
+#                  use the driver's scripts/stimulus.py
+# USE_SNAPSHOT - if set, `make bench` restores the system saved by
+#                `make snapshot` instead of booting it
+# AUTORUN_CMD - command run at boot from the initramfs overlay (BENCH_CMD by
+#               default; empty to only load the module)
 
 BUILD_DIR          ?= $(PWD)/build
 BUILD_DIR_MAKEFILE ?= $(BUILD_DIR)/Makefile
 VIRTIO_BUILD       ?= $(PWD)/drive.img
+BENCH_DIR          ?= $(PWD)/bench
+KUNIT_DIR          ?= $(BUILD_DIR)/kunit
+BENCH_CMD          ?= ./test_app
+BENCH_RESC         ?= scripts/litex.resc
+RENODE_TEST        ?= renode-test
+OVERLAY_DIR        ?= $(PWD)/overlay
+OVERLAY_CPIO       ?= $(PWD)/overlay.cpio
+AUTORUN_CMD        ?= $(BENCH_CMD)
+# where scripts/litex_template.resc loads the overlay, relative to rootfs.cpio
+OVERLAY_OFFSET     ?= 0x700000
+# room left for the overlay up to linux,initrd-end of the smallest rv32.dts
+OVERLAY_MAX        ?= 0x100000
+ROOTFS_CPIO        ?= $(BUILDROOT_BUILD)/images/rootfs.cpio
+SNAPSHOT           ?= $(PWD)/snapshot.save
+
+DRIVER_NAME := $(notdir $(PWD))
+
+# passed through the environment, so that no character of it needs escaping
+export AUTORUN_CMD
 
 RV_DTB   ?= $(DTS_SRC:%.dts=$(BUILD_DIR)/%.dtb)
 MOD_KO   ?= $(MOD_SRC:%.c=$(BUILD_DIR)/%.ko)
 TEST_EXE ?= $(TEST_SRC:%.c=$(BUILD_DIR)/%)
+KUNIT_KO ?= $(KUNIT_SRC:%.c=$(KUNIT_DIR)/%.ko)
 
 dtb: $(RV_DTB)
 test: $(TEST_EXE)
 modules: $(MOD_KO)
 
-# build device tree blob
-$(RV_DTB): $(DTS_SRC) $(BUILD_DIR)
+# build device tree blobs - a variant may include another source
+$(RV_DTB): $(BUILD_DIR)/%.dtb: %.dts $(DTS_SRC) $(BUILD_DIR)
 	dtc -I dts -O dtb -o $@ $<
 
-# build test application
-$(TEST_EXE): $(TEST_SRC) $(BUILD_DIR)
-	$(CROSS_COMP)$(CC) -Og -Wall -o $@ $<
+# build test applications
+$(TEST_EXE): $(BUILD_DIR)/%: %.c $(BUILD_DIR)
+	$(CROSS_COMP)$(CC) -Og -Wall -I${TOPDIR}/include -o $@ $< $(TEST_LDLIBS)
 
 # build the kernel module
 $(MOD_KO): $(MOD_SRC) $(BUILD_DIR_MAKEFILE)
@@ -32,9 +65,19 @@ $(MOD_KO): $(MOD_SRC) $(BUILD_DIR_MAKEFILE)
 $(BUILD_DIR_MAKEFILE): $(BUILD_DIR)
 	touch $@
 	
-$(BUILD_DIR):
+$(BUILD_DIR) $(KUNIT_DIR):
 	mkdir -p $@
 
+# build the KUnit suites against the UML kernel (`make build-linux-uml` in the
+# top directory) and run them on the build host - no emulator is involved
+kunit: $(KUNIT_KO)
+	${TOPDIR}/scripts/kunit_run.sh ${UML_BUILD}/linux $(KUNIT_KO)
+
+$(KUNIT_KO): $(KUNIT_SRC) $(MOD_SRC) $(KUNIT_DIR)
+	touch $(KUNIT_DIR)/Makefile
+	${MAKE} -C ${LINUX_SOURCE} O=${UML_BUILD} ARCH=um CROSS_COMPILE= \
+		M=$(KUNIT_DIR) src=$(PWD) modules
+
 build-virtio:
 	truncate -s 64M ${VIRTIO_BUILD}
 	mkfs.ext4 -d ${BUILD_DIR} ${VIRTIO_BUILD}
@@ -42,8 +85,75 @@ build-virtio:
 clean-virtio:
 	rm -f ${VIRTIO_BUILD}
 
-clean: clean-virtio
+# a faster alternative to build-virtio: pack the module, the test apps and an
+# init script that loads the module and runs AUTORUN_CMD into a small cpio
+# archive, which is loaded next to rootfs.cpio by scripts/litex_initramfs.resc
+build-initramfs: $(MOD_KO) $(TEST_EXE)
+	@size=$$(stat -c %s $(ROOTFS_CPIO)) || exit 1; \
+	if [ $$size -gt $$(($(OVERLAY_OFFSET))) ]; then \
+		echo "$(ROOTFS_CPIO) ($$size bytes) would be overwritten by" \
+			"the overlay loaded $(OVERLAY_OFFSET) bytes after it -" \
+			"move \$$overlay_addr in scripts/litex_template.resc" \
+			"and OVERLAY_OFFSET" >&2; \
+		exit 1; \
+	fi
+	rm -rf $(OVERLAY_DIR)
+	mkdir -p $(OVERLAY_DIR)/opt/$(DRIVER_NAME) $(OVERLAY_DIR)/etc/init.d
+	cp $(MOD_KO) $(TEST_EXE) $(OVERLAY_DIR)/opt/$(DRIVER_NAME)
+	$(CROSS_COMP)strip --strip-debug \
+		$(OVERLAY_DIR)/opt/$(DRIVER_NAME)/$(notdir $(MOD_KO))
+	[ -z "$$AUTORUN_CMD" ] || printf '%s\n' "$$AUTORUN_CMD" \
+		> $(OVERLAY_DIR)/opt/$(DRIVER_NAME)/autorun
+	sed -e 's|@DRIVER@|$(DRIVER_NAME)|g' \
+		-e 's|@MODULE@|$(notdir $(MOD_KO))|g' \
+		${TOPDIR}/scripts/overlay_init.sh.in \
+		> $(OVERLAY_DIR)/etc/init.d/S90$(DRIVER_NAME)
+	chmod 755 $(OVERLAY_DIR)/etc/init.d/S90$(DRIVER_NAME)
+	cd $(OVERLAY_DIR) && find . -mindepth 1 | cpio -o -H newc -R 0:0 > $(OVERLAY_CPIO)
+	@size=$$(stat -c %s $(OVERLAY_CPIO)) || exit 1; \
+	if [ $$size -gt $$(($(OVERLAY_MAX))) ]; then \
+		echo "$(OVERLAY_CPIO) ($$size bytes) does not fit in the" \
+			"$(OVERLAY_MAX) bytes left before linux,initrd-end" \
+			"in rv32.dts" >&2; \
+		rm -f $(OVERLAY_CPIO); \
+		exit 1; \
+	fi
+
+clean-initramfs:
+	rm -rf $(OVERLAY_DIR) $(OVERLAY_CPIO)
+
+# boot the platform headless, run BENCH_CMD and parse its output into
+# $(BENCH_DIR)/results.{json,csv}; fails if the benchmark did
+bench: all build-virtio
+	mkdir -p $(BENCH_DIR)
+	${RENODE_TEST} ${TOPDIR}/scripts/bench.robot \
+		--results-dir $(BENCH_DIR) \
+		--variable TOPDIR:${TOPDIR} \
+		--variable DRIVER:$(DRIVER_NAME) \
+		--variable RESC:$(BENCH_RESC) \
+		--variable MODULE:$(notdir $(MOD_KO)) \
+		--variable "BENCH_CMD:$(BENCH_CMD)" \
+		--variable "STIMULUS:$(BENCH_STIMULUS)" \
+		--variable UART_LOG:$(BENCH_DIR)/uart.log \
+		--variable VIRTIO:$(VIRTIO_BUILD) \
+		--variable SNAPSHOT:$(if $(USE_SNAPSHOT),$(SNAPSHOT)); \
+	status=$$?; \
+	python3 ${TOPDIR}/scripts/bench_parse.py $(BENCH_DIR)/uart.log \
+		$(DRIVER_NAME) $(BENCH_DIR)/results && exit $$status
+
+# boot the platform headless once, up to the shell prompt, and save it - the
+# snapshot only depends on the kernel, rootfs, dtb and platform description
+snapshot: dtb build-virtio
+	mkdir -p $(BENCH_DIR)
+	${RENODE_TEST} ${TOPDIR}/scripts/snapshot.robot \
+		--results-dir $(BENCH_DIR) \
+		--variable TOPDIR:${TOPDIR} \
+		--variable DRIVER:$(DRIVER_NAME) \
+		--variable RESC:$(BENCH_RESC) \
+		--variable SNAPSHOT:$(SNAPSHOT)
+
+clean: clean-virtio clean-initramfs
 	${MAKE} -C ${LINUX_SOURCE} M=${PWD} clean
-	rm -rf $(BUILD_DIR)
+	rm -rf $(BUILD_DIR) $(BENCH_DIR) $(SNAPSHOT)
 
-.PHONY: clean build-virtio clean-virtio
+.PHONY: clean build-virtio clean-virtio build-initramfs clean-initramfs bench snapshot kunit
@@ -7,6 +7,7 @@ LINUX_SOURCE    = /root/linux
 
 BUILDROOT_BUILD = /root/build/buildroot
 LINUX_BUILD     = /root/build/linux
+UML_BUILD       = /root/build/linux-uml
 else
 BUILDROOT_SOURCE ?= ${TOPDIR}/third_party/buildroot
 LINUX_SOURCE     ?= ${TOPDIR}/third_party/linux
@@ -15,8 +16,10 @@ RENODE_SOURCE    ?= ${TOPDIR}/third_party/renode
 
 BUILDROOT_BUILD ?= ${TOPDIR}/build/buildroot
 LINUX_BUILD     ?= ${TOPDIR}/build/linux
+UML_BUILD       ?= ${TOPDIR}/build/linux-uml
 OPENSBI_BUILD   ?= ${TOPDIR}/build/opensbi
 RENODE_BUILD    ?= ${TOPDIR}/build/renode
+RENODE_TEST     ?= ${RENODE_SOURCE}/renode-test
 endif
 
 export ARCH=riscv
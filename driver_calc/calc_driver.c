@@ -5,212 +5,822 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/ioport.h>
+#include <linux/mm.h>
+#include <linux/capability.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+#include <linux/uio.h>
+#include <linux/mutex.h>
 #include <asm/ioctl.h>
 #include <asm/io.h>
 #include "calc_driver.h"
+#include "calc_regs.h"
+#include "calc_sw.h"
+#include "dev_registry.h"
 
-#define STATUS_REG_OFFSET 0x00
-#define OPERATION_REG_OFFSET 0x04
-#define DAT0_REG_OFFSET 0x08
-#define DAT1_REG_OFFSET 0x0c
-#define RESULT_REG_OFFSET 0x10
+#define CREATE_TRACE_POINTS
+#include "calc_trace.h"
 
 static int calc_major;
 
-#define CALC_MAX_MINORS 3
+/* mapping the registers into user space bypasses the driver - opt-in only */
+static bool mmap_enable;
+module_param(mmap_enable, bool, 0444);
+MODULE_PARM_DESC(mmap_enable,
+		 "Allow CAP_SYS_RAWIO processes to mmap the registers");
 
-static unsigned char calc_minors[CALC_MAX_MINORS] = { 0 };
+#define CALC_MAX_MINORS DEV_REGISTRY_MAX_MINORS
 
+static DEFINE_DEV_REGISTRY(calc_registry, CALC_MAX_MINORS);
+
+/* Where the jobs of a device are run, selected in sysfs */
+enum calc_policy {
+	/* only the hardware; a single open at a time */
+	CALC_POLICY_HW,
+	/* the hardware, unless it is held or slower than hybrid_latency_us */
+	CALC_POLICY_HYBRID,
+	/* only the software path; any number of opens */
+	CALC_POLICY_CPU,
+};
+
+static const char *const calc_policy_names[] = {
+	[CALC_POLICY_HW] = "hw",
+	[CALC_POLICY_HYBRID] = "hybrid",
+	[CALC_POLICY_CPU] = "cpu",
+};
+
+#define CALC_HYBRID_LATENCY_US 50
+/* in hybrid mode every n-th job of the holder still goes to the hardware */
+#define CALC_HW_PROBE_INTERVAL 16
+
+/* results queued by the streaming mode of a file */
+#define CALC_STREAM_RESULTS 1024
+/* pairs of operands copied from the user at once */
+#define CALC_STREAM_BATCH 32
+
+/*
+ * Lives until the last file of the device is closed, as the cdev holds a
+ * reference to `dev` - so do the registers, which are unmapped by its release.
+ */
 struct calc_device_data {
 	struct cdev cdev;
+	struct device dev;
 	void *__iomem base;
+	/* physical address of the registers, for mmap */
+	phys_addr_t phys;
+	/*
+	 * protects the fields below, and the accesses of the files to the
+	 * registers, against the removal of the device
+	 */
+	struct mutex mmap_lock;
+	/* the registers were mapped by the current opener, through `mapping` */
+	bool mapped;
+	struct address_space *mapping;
+	/* the device was removed, its mappings must not be faulted in again */
+	bool gone;
 	unsigned int opened;
 	spinlock_t open_lock;
+	/* dispatcher */
+	enum calc_policy policy;
+	unsigned int hybrid_latency_us;
+	/* moving average of the latency of an operation of the hardware */
+	unsigned long hw_latency_ns;
+	/* number of files open on the device, whatever path they use */
+	atomic_t open_files;
+	atomic_long_t hw_jobs;
+	atomic_long_t cpu_jobs;
+};
+
+/*
+ * State of an open file. The operands and the result are kept here as well
+ * as in the registers, so that any job can be moved to the other path and a
+ * failed job leaves the result of the previous one, wherever it ran.
+ */
+struct calc_ctx {
+	struct calc_device_data *data;
+	/* the file holds the hardware, otherwise all its jobs run on the CPU */
+	bool on_hw;
+	/* the last job ran on the CPU, so its status isn't in the register */
+	bool last_on_cpu;
+	unsigned int jobs;
+	u32 dat0;
+	u32 dat1;
+	u32 status;
+	u32 result;
+	/* streaming mode, stream_op is 0 outside of it */
+	struct mutex stream_lock;
+	u32 stream_op;
+	struct calc_stream_result *results;
+	unsigned int nresults;
+	/* bytes of the results already read */
+	size_t results_pos;
+	/* a pair of operands split between writes */
+	u32 pending[2];
+	size_t pending_len;
 };
 
-static inline void write_addr(u32 val, void __iomem *addr)
+static int calc_open(struct inode *inode, struct file *file)
 {
-	writel((u32 __force)cpu_to_le32(val), addr);
+	struct calc_device_data *calc_data =
+		container_of(inode->i_cdev, struct calc_device_data, cdev);
+	enum calc_policy policy = READ_ONCE(calc_data->policy);
+	struct calc_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->data = calc_data;
+	mutex_init(&ctx->stream_lock);
+
+	/* the hardware can't be shared - interference could occur */
+	if (policy != CALC_POLICY_CPU) {
+		spin_lock(&calc_data->open_lock);
+		if (!calc_data->opened) {
+			calc_data->opened++;
+			ctx->on_hw = true;
+		}
+		spin_unlock(&calc_data->open_lock);
+	}
+
+	/* in hybrid mode, files that would wait for the hardware get the CPU */
+	if (!ctx->on_hw && policy == CALC_POLICY_HW) {
+		kfree(ctx);
+		return -EBUSY;
+	}
+
+	ctx->last_on_cpu = !ctx->on_hw;
+	atomic_inc(&calc_data->open_files);
+	file->private_data = ctx;
+
+	return 0;
 }
 
-static inline u32 read_addr(void __iomem *addr)
+static inline void *__iomem get_base_ptr(struct file *file)
 {
-	return le32_to_cpu((__le32 __force)readl(addr));
+	return ((struct calc_ctx *)file->private_data)->data->base;
 }
 
-static int calc_open(struct inode *inode, struct file *file)
+static inline unsigned int calc_minor(struct file *file)
 {
-	int ret = 0;
-	struct calc_device_data *calc_data =
-		container_of(inode->i_cdev, struct calc_device_data, cdev);
-	file->private_data = calc_data;
+	return iminor(file_inode(file));
+}
 
-	/* we dont want to open the device >1 times - interference could occur */
-	spin_lock(&calc_data->open_lock);
-	if (calc_data->opened)
-		ret = -EBUSY;
-	else
-		calc_data->opened++;
-	spin_unlock(&calc_data->open_lock);
+/*
+ * Let a file that holds the hardware access the registers, unless the device
+ * was removed meanwhile - from then on all its jobs run on the CPU. Returns
+ * true with the registers locked until calc_hw_unlock().
+ */
+static bool calc_hw_lock(struct calc_ctx *ctx)
+{
+	struct calc_device_data *data = ctx->data;
 
-	return ret;
+	if (!ctx->on_hw)
+		return false;
+
+	mutex_lock(&data->mmap_lock);
+	if (!data->gone)
+		return true;
+	mutex_unlock(&data->mmap_lock);
+	return false;
 }
 
-static inline void *__iomem get_base_ptr(struct file *file)
+static void calc_hw_unlock(struct calc_ctx *ctx)
 {
-	return ((struct calc_device_data *)file->private_data)->base;
+	mutex_unlock(&ctx->data->mmap_lock);
 }
 
-static ssize_t calc_read(struct file *file, char __user *buf, size_t count,
-			 loff_t *offset)
+/* Pick the path of the next job of a file */
+static bool calc_job_on_cpu(struct calc_ctx *ctx)
 {
-	void *base_ptr = get_base_ptr(file);
-	u32 result = read_addr(base_ptr + RESULT_REG_OFFSET);
-	size_t buf_size = count < (sizeof(result) - *offset) ?
-				  count :
-				  (sizeof(result) - *offset);
+	struct calc_device_data *data = ctx->data;
+	unsigned long limit_ns;
+
+	if (!ctx->on_hw)
+		return true;
+	/* the holder of a mapping drives the registers itself */
+	if (data->mapped)
+		return false;
+
+	switch (READ_ONCE(data->policy)) {
+	case CALC_POLICY_HW:
+		return false;
+	case CALC_POLICY_CPU:
+		return true;
+	default:
+		break;
+	}
 
-	if (copy_to_user(buf, &result, sizeof(result)))
-		return -EFAULT;
+	/* keep the latency up to date, even when the CPU takes the jobs */
+	if (!(++ctx->jobs % CALC_HW_PROBE_INTERVAL))
+		return false;
 
-	*offset += buf_size;
-	return buf_size;
+	limit_ns = READ_ONCE(data->hybrid_latency_us) * NSEC_PER_USEC;
+	return READ_ONCE(data->hw_latency_ns) > limit_ns;
 }
 
-static ssize_t calc_write(struct file *file, const char __user *buf,
-			  size_t count, loff_t *offset)
+static void calc_run_job(struct calc_ctx *ctx, unsigned int minor, u32 op)
 {
-	u32 old_data_reg1, user_data = 0;
-	size_t buf_size = count < sizeof(user_data) ? count : sizeof(user_data);
-	void *base_ptr = get_base_ptr(file);
+	struct calc_device_data *data = ctx->data;
+	unsigned long latency_ns, avg_ns;
+	ktime_t start;
+
+	if (calc_job_on_cpu(ctx) || !calc_hw_lock(ctx)) {
+		ctx->status = calc_sw_execute(op, ctx->dat0, ctx->dat1,
+					      &ctx->result);
+		ctx->last_on_cpu = true;
+		atomic_long_inc(&data->cpu_jobs);
+		trace_calc_job(minor, op, true, ctx->status, 0);
+		return;
+	}
+
+	start = ktime_get();
+	write_addr(op, data->base + OPERATION_REG_OFFSET);
+	/* the status is read back to wait for the end of the operation */
+	ctx->status = calc_status(data->base);
+	latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	/* a failed operation keeps the previous result, as on the CPU */
+	if (!ctx->status)
+		ctx->result = read_addr(data->base + RESULT_REG_OFFSET);
+	calc_hw_unlock(ctx);
+
+	/* only the holder of the hardware updates the average */
+	avg_ns = data->hw_latency_ns;
+	WRITE_ONCE(data->hw_latency_ns, avg_ns - avg_ns / 8 + latency_ns / 8);
+
+	ctx->last_on_cpu = false;
+	atomic_long_inc(&data->hw_jobs);
+	trace_calc_job(minor, op, false, ctx->status, latency_ns);
+}
+
+/* Every read returns the current result, whatever the file position is */
+static ssize_t calc_read_result(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+	u32 result = ctx->result;
+	size_t buf_size = min(iov_iter_count(to), sizeof(result));
+	ssize_t ret = buf_size;
+
+	if (copy_to_iter(&result, buf_size, to) != buf_size)
+		ret = -EFAULT;
+
+	trace_calc_read(calc_minor(iocb->ki_filp), RESULT_REG_OFFSET, result,
+			ret);
+	return ret;
+}
+
+static ssize_t calc_write_operand(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+	u32 user_data = 0;
+	size_t buf_size = min(iov_iter_count(from), sizeof(user_data));
+	void *base_ptr = get_base_ptr(iocb->ki_filp);
 
-	if (copy_from_user(&user_data, buf, buf_size))
+	if (copy_from_iter(&user_data, buf_size, from) != buf_size) {
+		trace_calc_write(calc_minor(iocb->ki_filp), 0, 0, -EFAULT);
 		return -EFAULT;
+	}
 
-	/* Transfer DAT1_REG->DAT0_REG and write user data to DAT1_REG */
-	old_data_reg1 = read_addr(base_ptr + DAT1_REG_OFFSET);
-	write_addr(old_data_reg1, base_ptr + DAT0_REG_OFFSET);
-	write_addr(user_data, base_ptr + DAT1_REG_OFFSET);
+	ctx->dat0 = ctx->dat1;
+	ctx->dat1 = user_data;
+	if (calc_hw_lock(ctx)) {
+		calc_push_operand(base_ptr, user_data);
+		calc_hw_unlock(ctx);
+	}
 
+	trace_calc_write(calc_minor(iocb->ki_filp), ctx->dat0, user_data,
+			 buf_size);
 	return buf_size;
 }
 
+/*
+ * Streaming mode: every pair of operands written to the file is processed
+ * with the operation set by CALC_IOCTL_STREAM, and its result is queued for
+ * read. Pairs may be split between writes. When the queue is full, the
+ * results have to be read before more pairs are accepted.
+ */
+static int calc_stream_start(struct calc_ctx *ctx, u32 op)
+{
+	int ret = 0;
+
+	if (op != ADD && op != SUB && op != MUL && op != DIV)
+		return -EINVAL;
+	/* the holder of a mapping drives the registers itself */
+	if (ctx->data->mapped)
+		return -EBUSY;
+
+	mutex_lock(&ctx->stream_lock);
+	if (!ctx->results) {
+		ctx->results = kvmalloc_array(CALC_STREAM_RESULTS,
+					      sizeof(*ctx->results),
+					      GFP_KERNEL);
+		if (!ctx->results)
+			ret = -ENOMEM;
+	}
+	if (!ret)
+		ctx->stream_op = op;
+	mutex_unlock(&ctx->stream_lock);
+
+	return ret;
+}
+
+static void calc_stream_stop(struct calc_ctx *ctx)
+{
+	mutex_lock(&ctx->stream_lock);
+	kvfree(ctx->results);
+	ctx->results = NULL;
+	ctx->stream_op = 0;
+	ctx->nresults = 0;
+	ctx->results_pos = 0;
+	ctx->pending_len = 0;
+	mutex_unlock(&ctx->stream_lock);
+}
+
+/* Run the operation of the stream on a single pair of operands */
+static void calc_stream_pair(struct calc_ctx *ctx, unsigned int minor,
+			     const u32 *operands)
+{
+	struct calc_stream_result *res = &ctx->results[ctx->nresults++];
+	void __iomem *base = ctx->data->base;
+
+	ctx->dat0 = operands[0];
+	ctx->dat1 = operands[1];
+	if (calc_hw_lock(ctx)) {
+		write_addr(operands[0], base + DAT0_REG_OFFSET);
+		write_addr(operands[1], base + DAT1_REG_OFFSET);
+		calc_hw_unlock(ctx);
+	}
+
+	calc_run_job(ctx, minor, ctx->stream_op);
+
+	res->status = ctx->status;
+	/* a failed operation gives 0 on both paths */
+	res->result = ctx->status ? 0 : ctx->result;
+}
+
+/* Make room for the next result; returns false if the queue is full */
+static bool calc_stream_room(struct calc_ctx *ctx)
+{
+	size_t done = ctx->results_pos / sizeof(*ctx->results);
+
+	if (ctx->nresults < CALC_STREAM_RESULTS)
+		return true;
+	if (!done)
+		return false;
+
+	/* drop the results that were read entirely */
+	memmove(ctx->results, ctx->results + done,
+		(ctx->nresults - done) * sizeof(*ctx->results));
+	ctx->nresults -= done;
+	ctx->results_pos -= done * sizeof(*ctx->results);
+	return true;
+}
+
+static ssize_t calc_stream_write(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+	unsigned int minor = calc_minor(iocb->ki_filp);
+	u32 batch[2 * CALC_STREAM_BATCH];
+	size_t len, pairs, i, written = 0;
+	ssize_t ret = 0;
+
+	mutex_lock(&ctx->stream_lock);
+	/* the stream was stopped by another thread */
+	if (!ctx->stream_op)
+		ret = -EINVAL;
+	while (!ret && iov_iter_count(from) && calc_stream_room(ctx)) {
+		/* a pair split between writes, or the end of the buffer */
+		if (ctx->pending_len ||
+		    iov_iter_count(from) < sizeof(ctx->pending)) {
+			len = min(iov_iter_count(from),
+				  sizeof(ctx->pending) - ctx->pending_len);
+			if (copy_from_iter((u8 *)ctx->pending +
+						   ctx->pending_len,
+					   len, from) != len) {
+				ret = -EFAULT;
+				break;
+			}
+			written += len;
+			ctx->pending_len += len;
+			if (ctx->pending_len == sizeof(ctx->pending)) {
+				calc_stream_pair(ctx, minor, ctx->pending);
+				ctx->pending_len = 0;
+			}
+			continue;
+		}
+
+		pairs = min3(iov_iter_count(from) / sizeof(ctx->pending),
+			     (size_t)CALC_STREAM_BATCH,
+			     (size_t)(CALC_STREAM_RESULTS - ctx->nresults));
+		len = pairs * sizeof(ctx->pending);
+		if (copy_from_iter(batch, len, from) != len) {
+			ret = -EFAULT;
+			break;
+		}
+		written += len;
+		for (i = 0; i < pairs; i++)
+			calc_stream_pair(ctx, minor, &batch[2 * i]);
+	}
+	mutex_unlock(&ctx->stream_lock);
+
+	if (written)
+		ret = written;
+	else if (!ret && iov_iter_count(from))
+		ret = -EAGAIN;
+
+	trace_calc_stream(minor, true, ret);
+	return ret;
+}
+
+/* Drain the queued results; returns 0 if there are none */
+static ssize_t calc_stream_read(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+	size_t avail, len;
+	ssize_t ret;
+
+	mutex_lock(&ctx->stream_lock);
+	avail = ctx->nresults * sizeof(*ctx->results) - ctx->results_pos;
+	len = min(avail, iov_iter_count(to));
+	ret = copy_to_iter((u8 *)ctx->results + ctx->results_pos, len, to);
+	if (!ret && len) {
+		ret = -EFAULT;
+	} else {
+		ctx->results_pos += ret;
+		/* everything was read - start from the beginning */
+		if (ret == avail) {
+			ctx->nresults = 0;
+			ctx->results_pos = 0;
+		}
+	}
+	mutex_unlock(&ctx->stream_lock);
+
+	trace_calc_stream(calc_minor(iocb->ki_filp), false, ret);
+	return ret;
+}
+
+static ssize_t calc_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+
+	if (READ_ONCE(ctx->stream_op))
+		return calc_stream_read(iocb, to);
+	return calc_read_result(iocb, to);
+}
+
+static ssize_t calc_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct calc_ctx *ctx = iocb->ki_filp->private_data;
+
+	if (READ_ONCE(ctx->stream_op))
+		return calc_stream_write(iocb, from);
+	return calc_write_operand(iocb, from);
+}
+
 static long calc_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct calc_ctx *ctx = file->private_data;
 	void *base_ptr = get_base_ptr(file);
-	u32 status;
+	u32 offset = 0, value = 0;
+	long ret = 0;
 
 	switch (cmd) {
 	case CALC_IOCTL_RESET:
-		write_addr((u32)STATUS_MASK_ALL, base_ptr + STATUS_REG_OFFSET);
+		offset = STATUS_REG_OFFSET;
+		value = (u32)STATUS_MASK_ALL;
+		ctx->status = 0;
+		if (calc_hw_lock(ctx)) {
+			calc_clear_status(base_ptr);
+			calc_hw_unlock(ctx);
+		}
 		break;
 	case CALC_IOCTL_CHANGE_OP:
-		write_addr((u32)arg, base_ptr + OPERATION_REG_OFFSET);
+		offset = OPERATION_REG_OFFSET;
+		value = (u32)arg;
+		if (READ_ONCE(ctx->stream_op))
+			ret = -EBUSY;
+		else
+			calc_run_job(ctx, calc_minor(file), value);
+		break;
+	case CALC_IOCTL_STREAM:
+		offset = OPERATION_REG_OFFSET;
+		value = (u32)arg;
+		if (value)
+			ret = calc_stream_start(ctx, value);
+		else
+			calc_stream_stop(ctx);
 		break;
 	case CALC_IOCTL_CHECK_STATUS:
-		status = read_addr(base_ptr + STATUS_REG_OFFSET);
-		if (copy_to_user((u32 *)arg, &status, sizeof(status)))
-			return -EFAULT;
+		offset = STATUS_REG_OFFSET;
+		value = ctx->status;
+		if (!ctx->last_on_cpu && calc_hw_lock(ctx)) {
+			value = calc_status(base_ptr);
+			calc_hw_unlock(ctx);
+		}
+		if (copy_to_user((u32 *)arg, &value, sizeof(value)))
+			ret = -EFAULT;
 		break;
 	default:
+		ret = -EINVAL;
+	}
+
+	trace_calc_ioctl(calc_minor(file), cmd, offset, value, ret);
+	return ret;
+}
+
+/* The page is inserted on the first access, unless the device is gone */
+static vm_fault_t calc_vm_fault(struct vm_fault *vmf)
+{
+	struct calc_ctx *ctx = vmf->vma->vm_file->private_data;
+	struct calc_device_data *calc_data = ctx->data;
+	vm_fault_t ret = VM_FAULT_SIGBUS;
+
+	mutex_lock(&calc_data->mmap_lock);
+	if (!calc_data->gone)
+		ret = vmf_insert_pfn(vmf->vma, vmf->address,
+				     calc_data->phys >> PAGE_SHIFT);
+	mutex_unlock(&calc_data->mmap_lock);
+
+	return ret;
+}
+
+static const struct vm_operations_struct calc_vm_ops = {
+	.fault = calc_vm_fault,
+};
+
+/*
+ * Map the page with the registers of the device, e.g. with
+ * calc_mmap_open() from calc_mmap.h. The process then drives the device
+ * directly, without a syscall per operation. The mapping keeps the file
+ * open, so the device stays exclusive until both are gone. Removing the
+ * device zaps the mapping; later accesses get SIGBUS.
+ */
+static int calc_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct calc_ctx *ctx = file->private_data;
+	struct calc_device_data *calc_data = ctx->data;
+	int ret = 0;
+
+	if (!mmap_enable || !capable(CAP_SYS_RAWIO))
+		return -EPERM;
+	/* the hardware is held by another file, or streamed to by this one */
+	if (!ctx->on_hw || READ_ONCE(ctx->stream_op))
+		return -EBUSY;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
 		return -EINVAL;
+	/* a window that doesn't start a page would expose its neighbours */
+	if (offset_in_page(calc_data->phys))
+		return -ENODEV;
+
+	mutex_lock(&calc_data->mmap_lock);
+	if (calc_data->gone) {
+		ret = -ENODEV;
+	} else {
+		vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND |
+				 VM_DONTDUMP;
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		vma->vm_ops = &calc_vm_ops;
+		calc_data->mapping = file->f_mapping;
+		calc_data->mapped = true;
 	}
-	return 0;
+	mutex_unlock(&calc_data->mmap_lock);
+
+	return ret;
 }
 
 static int calc_release(struct inode *inode, struct file *file)
 {
-	struct calc_device_data *calc_data = file->private_data;
+	struct calc_ctx *ctx = file->private_data;
+	struct calc_device_data *calc_data = ctx->data;
+
+	/* don't leave the state of a bypassing process to the next opener */
+	mutex_lock(&calc_data->mmap_lock);
+	if (calc_data->mapped && ctx->on_hw) {
+		if (!calc_data->gone) {
+			calc_clear_status(calc_data->base);
+			calc_push_operand(calc_data->base, 0);
+			calc_push_operand(calc_data->base, 0);
+		}
+		calc_data->mapped = false;
+		calc_data->mapping = NULL;
+	}
+	mutex_unlock(&calc_data->mmap_lock);
 
-	spin_lock(&calc_data->open_lock);
-	calc_data->opened = 0;
-	spin_unlock(&calc_data->open_lock);
+	if (ctx->on_hw) {
+		spin_lock(&calc_data->open_lock);
+		calc_data->opened = 0;
+		spin_unlock(&calc_data->open_lock);
+	}
 
+	atomic_dec(&calc_data->open_files);
+	kvfree(ctx->results);
+	kfree(ctx);
 	return 0;
 }
 
-static struct class *calc_class;
+static ssize_t policy_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+	enum calc_policy policy = READ_ONCE(data->policy);
+	ssize_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(calc_policy_names); i++)
+		len += sysfs_emit_at(buf, len, i == policy ? "[%s] " : "%s ",
+				     calc_policy_names[i]);
+	buf[len - 1] = '\n';
 
-const struct file_operations calc_fops = { .owner = THIS_MODULE,
-					   .open = calc_open,
-					   .read = calc_read,
-					   .write = calc_write,
-					   .unlocked_ioctl = calc_ioctl,
-					   .release = calc_release };
+	return len;
+}
 
-static int get_calc_minor(void)
+/* only the files opened afterwards get the hardware or the CPU accordingly */
+static ssize_t policy_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
 {
-	unsigned int i;
+	struct calc_device_data *data = dev_get_drvdata(dev);
+	int policy = sysfs_match_string(calc_policy_names, buf);
+
+	if (policy < 0)
+		return policy;
+
+	WRITE_ONCE(data->policy, policy);
+	return count;
+}
+static DEVICE_ATTR_RW(policy);
 
-	for (i = 0; i < CALC_MAX_MINORS; i++)
-		if (calc_minors[i] == 0)
-			return i;
+static ssize_t hybrid_latency_us_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
 
-	return -1;
+	return sysfs_emit(buf, "%u\n", READ_ONCE(data->hybrid_latency_us));
+}
+
+static ssize_t hybrid_latency_us_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+	unsigned int latency_us;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &latency_us);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(data->hybrid_latency_us, latency_us);
+	return count;
+}
+static DEVICE_ATTR_RW(hybrid_latency_us);
+
+static ssize_t hw_latency_ns_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(data->hw_latency_ns));
+}
+static DEVICE_ATTR_RO(hw_latency_ns);
+
+static ssize_t open_files_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", atomic_read(&data->open_files));
+}
+static DEVICE_ATTR_RO(open_files);
+
+static ssize_t hw_jobs_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&data->hw_jobs));
+}
+static DEVICE_ATTR_RO(hw_jobs);
+
+static ssize_t cpu_jobs_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct calc_device_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&data->cpu_jobs));
+}
+static DEVICE_ATTR_RO(cpu_jobs);
+
+static struct attribute *calc_attrs[] = {
+	&dev_attr_policy.attr,
+	&dev_attr_hybrid_latency_us.attr,
+	&dev_attr_hw_latency_ns.attr,
+	&dev_attr_open_files.attr,
+	&dev_attr_hw_jobs.attr,
+	&dev_attr_cpu_jobs.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(calc);
+
+static struct class *calc_class;
+
+const struct file_operations calc_fops = {
+	.owner = THIS_MODULE,
+	.open = calc_open,
+	.read_iter = calc_read_iter,
+	.write_iter = calc_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.unlocked_ioctl = calc_ioctl,
+	.mmap = calc_mmap,
+	.release = calc_release,
+};
+
+static void calc_device_release(struct device *dev)
+{
+	struct calc_device_data *data =
+		container_of(dev, struct calc_device_data, dev);
+
+	if (data->base)
+		iounmap(data->base);
+	kfree(data);
 }
 
 static int calc_driver_probe(struct platform_device *pdev)
 {
 	struct calc_device_data *data;
-	unsigned int minor;
+	int minor;
 	long ret;
 	struct resource *mem_res;
 
-	minor = get_calc_minor();
-	if (minor == -1) {
-		printk(KERN_ERR "calc_driver: reached max number of devices\n");
-		return -EIO;
-	}
-	calc_minors[minor] = 1;
-
-	data = devm_kzalloc(&pdev->dev, sizeof(struct calc_device_data),
-			    GFP_KERNEL);
+	data = kzalloc(sizeof(struct calc_device_data), GFP_KERNEL);
 	if (!data) {
 		printk(KERN_ERR
 		       "calc_driver: unable to allocate driver data\n");
-		ret = -ENOMEM;
-		goto err_min_ret;
+		return -ENOMEM;
 	}
+	device_initialize(&data->dev);
+	data->dev.release = calc_device_release;
 
-	cdev_init(&data->cdev, &calc_fops);
-	ret = cdev_add(&data->cdev, MKDEV(calc_major, minor), 1);
-	if (ret) {
-		printk(KERN_ERR "calc_driver: cdev_add failed\n");
-		goto err_min_ret;
+	minor = dev_registry_add(&calc_registry, data);
+	if (minor < 0) {
+		printk(KERN_ERR "calc_driver: reached max number of devices\n");
+		ret = minor;
+		goto err_put_dev;
 	}
 
 	mem_res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	if (IS_ERR(mem_res)) {
+	if (!mem_res) {
 		printk(KERN_ERR "calc_driver: cannot get memory resource\n");
-		ret = PTR_ERR(mem_res);
-		goto err_cdev_del;
+		ret = -ENODEV;
+		goto err_min_ret;
 	}
 
-	data->base = devm_ioremap_resource(&pdev->dev, mem_res);
-	if (IS_ERR(data->base)) {
+	if (!devm_request_mem_region(&pdev->dev, mem_res->start,
+				     resource_size(mem_res), pdev->name)) {
+		printk(KERN_ERR "calc_driver: cannot request memory region\n");
+		ret = -EBUSY;
+		goto err_min_ret;
+	}
+	data->phys = mem_res->start;
+	/* not devm - the registers stay mapped while the files are open */
+	data->base = ioremap(mem_res->start, resource_size(mem_res));
+	if (!data->base) {
 		printk(KERN_ERR "calc_driver: cannot remap memory resource\n");
-		ret = PTR_ERR(data->base);
-		goto err_cdev_del;
+		ret = -ENOMEM;
+		goto err_min_ret;
 	}
 
 	spin_lock_init(&data->open_lock);
+	mutex_init(&data->mmap_lock);
 	data->opened = 0;
+	data->policy = CALC_POLICY_HW;
+	data->hybrid_latency_us = CALC_HYBRID_LATENCY_US;
+
+	data->dev.class = calc_class;
+	data->dev.parent = &pdev->dev;
+	data->dev.devt = MKDEV(calc_major, minor);
+	data->dev.groups = calc_groups;
+	dev_set_drvdata(&data->dev, data);
+	ret = dev_set_name(&data->dev, "calc-%u", minor);
+	if (ret)
+		goto err_min_ret;
 
-	platform_set_drvdata(pdev, data);
+	cdev_init(&data->cdev, &calc_fops);
+	ret = cdev_device_add(&data->cdev, &data->dev);
+	if (ret) {
+		printk(KERN_ERR "calc_driver: cannot add char device\n");
+		goto err_min_ret;
+	}
 
-	if (IS_ERR(device_create(calc_class, &pdev->dev,
-				 MKDEV(calc_major, minor), NULL, "calc-%u",
-				 minor)))
-		printk(KERN_ERR "calc_driver: cannot create char device\n");
+	platform_set_drvdata(pdev, data);
 
 	printk(KERN_INFO "calc_driver: successful probe of device: %s\n",
 	       pdev->name);
 	return 0;
 
-err_cdev_del:
-	cdev_del(&data->cdev);
 err_min_ret:
-	calc_minors[minor] = 0;
+	dev_registry_remove(&calc_registry, minor);
+err_put_dev:
+	put_device(&data->dev);
 	return ret;
 }
 
@@ -220,12 +830,25 @@ static int calc_driver_remove(struct platform_device *pdev)
 	unsigned int minor;
 
 	data = platform_get_drvdata(pdev);
-	minor = MINOR(data->cdev.dev);
+	minor = MINOR(data->dev.devt);
+
+	cdev_device_del(&data->cdev, &data->dev);
+
+	/*
+	 * zap the mappings of the files still open, faults now get SIGBUS and
+	 * the jobs of the files run on the CPU
+	 */
+	mutex_lock(&data->mmap_lock);
+	data->gone = true;
+	if (data->mapping)
+		unmap_mapping_range(data->mapping, 0, 0, 1);
+	mutex_unlock(&data->mmap_lock);
 
-	cdev_del(&data->cdev);
-	calc_minors[minor] = 0;
+	/* the files still open keep the data, not the minor */
+	dev_registry_remove(&calc_registry, minor);
 
-	device_destroy(calc_class, MKDEV(calc_major, minor));
+	/* the data is freed once the last open file is closed */
+	put_device(&data->dev);
 
 	return 0;
 }
@@ -275,7 +898,7 @@ int init_module(void)
 err_cls:
 	class_destroy(calc_class);
 err_unreg:
-	unregister_chrdev_region(calc_major, CALC_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(calc_major, 0), CALC_MAX_MINORS);
 	return ret;
 }
 
@@ -283,9 +906,10 @@ void cleanup_module()
 {
 	printk(KERN_INFO "calc_driver removal\n");
 
-	unregister_chrdev_region(calc_major, CALC_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(calc_major, 0), CALC_MAX_MINORS);
 	platform_driver_unregister(&calc_driver);
 	class_destroy(calc_class);
+	dev_registry_destroy(&calc_registry);
 }
 
 MODULE_LICENSE("GPL");
@@ -1,6 +1,13 @@
 #ifndef _CALC_DRIVER_H
 #define _CALC_DRIVER_H
 
+/* Register map, also used by the processes that mmap the device */
+#define STATUS_REG_OFFSET 0x00
+#define OPERATION_REG_OFFSET 0x04
+#define DAT0_REG_OFFSET 0x08
+#define DAT1_REG_OFFSET 0x0c
+#define RESULT_REG_OFFSET 0x10
+
 #define ADD (1 << 0)
 #define SUB (1 << 1)
 #define MUL (1 << 2)
@@ -13,5 +20,13 @@
 #define CALC_IOCTL_RESET _IO('C', 0)
 #define CALC_IOCTL_CHANGE_OP _IOW('C', 1, long)
 #define CALC_IOCTL_CHECK_STATUS _IOR('C', 2, long)
+/* process pairs of operands written in bulk with the op; 0 stops streaming */
+#define CALC_IOCTL_STREAM _IOW('C', 3, long)
+
+/* Read in streaming mode for each pair of operands written */
+struct calc_stream_result {
+	int result;
+	unsigned int status;
+};
 
 #endif
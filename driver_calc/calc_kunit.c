@@ -0,0 +1,228 @@
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include "calc_regs.h"
+#include "calc_sw.h"
+#include "dev_registry.h"
+
+/* number of calls timed by the *_cost test cases */
+#define CALC_KUNIT_ITERS 100000
+
+#define CALC_REGS_SIZE (RESULT_REG_OFFSET + sizeof(u32))
+
+/* Each test case gets a fresh, zeroed register block in memory */
+static int calc_kunit_init(struct kunit *test)
+{
+	test->priv = kunit_kzalloc(test, CALC_REGS_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, test->priv);
+
+	return 0;
+}
+
+static void calc_kunit_push_operand(struct kunit *test)
+{
+	void __iomem *base = (void __iomem *)test->priv;
+
+	KUNIT_EXPECT_EQ(test, calc_push_operand(base, 15), 0U);
+	KUNIT_EXPECT_EQ(test, calc_push_operand(base, 34), 15U);
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT0_REG_OFFSET), 15U);
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT1_REG_OFFSET), 34U);
+
+	/* negative operands pass through unchanged */
+	calc_push_operand(base, (u32)-3087);
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT0_REG_OFFSET), 34U);
+	KUNIT_EXPECT_EQ(test, (s32)read_addr(base + DAT1_REG_OFFSET), -3087);
+
+	/* only the operand registers are written */
+	KUNIT_EXPECT_EQ(test, calc_status(base), 0U);
+	KUNIT_EXPECT_EQ(test, read_addr(base + OPERATION_REG_OFFSET), 0U);
+	KUNIT_EXPECT_EQ(test, read_addr(base + RESULT_REG_OFFSET), 0U);
+}
+
+static void calc_kunit_status(struct kunit *test)
+{
+	void __iomem *base = (void __iomem *)test->priv;
+	u8 *regs = test->priv;
+
+	/* the registers are little-endian, whatever the CPU is */
+	regs[STATUS_REG_OFFSET] = STATUS_DIV_ZERO;
+	KUNIT_EXPECT_EQ(test, calc_status(base), (u32)STATUS_DIV_ZERO);
+
+	write_addr(STATUS_INV_OP, base + STATUS_REG_OFFSET);
+	KUNIT_EXPECT_EQ(test, calc_status(base) & STATUS_MASK_ALL,
+			(u32)STATUS_INV_OP);
+
+	/*
+	 * The status bits are write-1-to-clear, which the block in memory
+	 * doesn't emulate - it's enough to check that every bit gets a one.
+	 */
+	calc_clear_status(base);
+	KUNIT_EXPECT_EQ(test, calc_status(base), (u32)STATUS_MASK_ALL);
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT0_REG_OFFSET), 0U);
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT1_REG_OFFSET), 0U);
+}
+
+/* The software path must give what the device model gives */
+static void calc_kunit_sw_execute(struct kunit *test)
+{
+	u32 result = 0;
+
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(ADD, 15, 34, &result), 0U);
+	KUNIT_EXPECT_EQ(test, result, 49U);
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(MUL, 4, 34, &result), 0U);
+	KUNIT_EXPECT_EQ(test, result, 136U);
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(SUB, 1234, 4321, &result), 0U);
+	KUNIT_EXPECT_EQ(test, (s32)result, -3087);
+
+	/* 32-bit wraparound */
+	calc_sw_execute(ADD, 0xFFFFFFFF, 2, &result);
+	KUNIT_EXPECT_EQ(test, result, 1U);
+	calc_sw_execute(MUL, 0x10000, 0x10001, &result);
+	KUNIT_EXPECT_EQ(test, result, 0x10000U);
+
+	/* the operands are divided as unsigned values */
+	calc_sw_execute(DIV, 7, 2, &result);
+	KUNIT_EXPECT_EQ(test, result, 3U);
+	calc_sw_execute(DIV, (u32)-8, 2, &result);
+	KUNIT_EXPECT_EQ(test, result, 0x7FFFFFFCU);
+
+	/* a failed operation leaves the previous result */
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(DIV, 2, 0, &result),
+			(u32)STATUS_DIV_ZERO);
+	KUNIT_EXPECT_EQ(test, result, 0x7FFFFFFCU);
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(100, 6, 5, &result),
+			(u32)STATUS_INV_OP);
+	KUNIT_EXPECT_EQ(test, calc_sw_execute(ADD | SUB, 6, 5, &result),
+			(u32)STATUS_INV_OP);
+	KUNIT_EXPECT_EQ(test, result, 0x7FFFFFFCU);
+}
+
+static void calc_kunit_registry_alloc(struct kunit *test)
+{
+	static DEFINE_DEV_REGISTRY(reg, 4);
+	int data[5], i;
+
+	/* the lowest free minor is allocated first */
+	for (i = 0; i < 4; i++)
+		KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data[i]), i);
+	for (i = 0; i < 4; i++)
+		KUNIT_EXPECT_PTR_EQ(test, xa_load(&reg.devices, i),
+				    (void *)&data[i]);
+
+	/* all the minors are taken */
+	KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data[4]), -EBUSY);
+	KUNIT_EXPECT_PTR_EQ(test, xa_load(&reg.devices, 4), NULL);
+
+	/* a released minor is reused */
+	dev_registry_remove(&reg, 1);
+	KUNIT_EXPECT_PTR_EQ(test, xa_load(&reg.devices, 1), NULL);
+	KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data[4]), 1);
+	KUNIT_EXPECT_PTR_EQ(test, xa_load(&reg.devices, 1), (void *)&data[4]);
+
+	/* removing a free minor is harmless */
+	dev_registry_remove(&reg, 1);
+	dev_registry_remove(&reg, 1);
+	KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data[1]), 1);
+
+	dev_registry_destroy(&reg);
+	KUNIT_EXPECT_PTR_EQ(test, xa_load(&reg.devices, 0), NULL);
+}
+
+/* The whole range of minors reserved by a driver can be handed out */
+static void calc_kunit_registry_max(struct kunit *test)
+{
+	static DEFINE_DEV_REGISTRY(reg, DEV_REGISTRY_MAX_MINORS);
+	int data, i;
+
+	for (i = 0; i < DEV_REGISTRY_MAX_MINORS; i++)
+		KUNIT_ASSERT_EQ(test, dev_registry_add(&reg, &data), i);
+	KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data), -EBUSY);
+
+	dev_registry_remove(&reg, DEV_REGISTRY_MAX_MINORS - 1);
+	KUNIT_EXPECT_EQ(test, dev_registry_add(&reg, &data),
+			DEV_REGISTRY_MAX_MINORS - 1);
+
+	dev_registry_destroy(&reg);
+}
+
+/* The register sequences run on every write and ioctl */
+static void calc_kunit_regs_cost(struct kunit *test)
+{
+	void __iomem *base = (void __iomem *)test->priv;
+	s64 push_ns, status_ns;
+	ktime_t start;
+	u32 status;
+	unsigned int i;
+
+	start = ktime_get();
+	for (i = 0; i < CALC_KUNIT_ITERS; i++)
+		calc_push_operand(base, i);
+	push_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < CALC_KUNIT_ITERS; i++) {
+		status = calc_status(base);
+		barrier_data(&status);
+		calc_clear_status(base);
+	}
+	status_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	KUNIT_EXPECT_EQ(test, read_addr(base + DAT1_REG_OFFSET),
+			(u32)CALC_KUNIT_ITERS - 1);
+	kunit_info(test, "calc_push_operand: %lld ns/call\n",
+		   div_s64(push_ns, CALC_KUNIT_ITERS));
+	kunit_info(test, "calc_status + calc_clear_status: %lld ns/call\n",
+		   div_s64(status_ns, CALC_KUNIT_ITERS));
+}
+
+/* A minor is allocated on every probe and released on every removal */
+static void calc_kunit_registry_cost(struct kunit *test)
+{
+	static DEFINE_DEV_REGISTRY(reg, DEV_REGISTRY_MAX_MINORS);
+	s64 add_ns, remove_ns;
+	ktime_t start;
+	unsigned int i;
+	int data;
+
+	start = ktime_get();
+	for (i = 0; i < DEV_REGISTRY_MAX_MINORS; i++)
+		dev_registry_add(&reg, &data);
+	add_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < DEV_REGISTRY_MAX_MINORS; i++)
+		dev_registry_remove(&reg, i);
+	remove_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	KUNIT_EXPECT_TRUE(test, xa_empty(&reg.devices));
+	kunit_info(test, "dev_registry_add: %lld ns/call\n",
+		   div_s64(add_ns, DEV_REGISTRY_MAX_MINORS));
+	kunit_info(test, "dev_registry_remove: %lld ns/call\n",
+		   div_s64(remove_ns, DEV_REGISTRY_MAX_MINORS));
+
+	dev_registry_destroy(&reg);
+}
+
+static struct kunit_case calc_kunit_cases[] = {
+	KUNIT_CASE(calc_kunit_push_operand),
+	KUNIT_CASE(calc_kunit_status),
+	KUNIT_CASE(calc_kunit_sw_execute),
+	KUNIT_CASE(calc_kunit_registry_alloc),
+	KUNIT_CASE(calc_kunit_registry_max),
+	KUNIT_CASE(calc_kunit_regs_cost),
+	KUNIT_CASE(calc_kunit_registry_cost),
+	{}
+};
+
+static struct kunit_suite calc_kunit_suite = {
+	.name = "calc",
+	.init = calc_kunit_init,
+	.test_cases = calc_kunit_cases,
+};
+
+kunit_test_suites(&calc_kunit_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Antoni Pokusinski");
+MODULE_DESCRIPTION("KUnit tests of the calc driver");
@@ -0,0 +1,98 @@
+#ifndef _CALC_MMAP_H
+#define _CALC_MMAP_H
+
+/*
+ * Userspace access to the registers of a calc device, mapped by the driver.
+ *
+ * Every operation done through read/write/ioctl costs 5 syscalls; here it
+ * is a couple of loads and stores. The driver only allows the mapping when
+ * it is loaded with `mmap_enable=1` and the process has CAP_SYS_RAWIO. It
+ * still keeps the device exclusive while it is mapped and resets it after
+ * the last reference to the file is gone.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "calc_driver.h"
+
+struct calc_mmap {
+	int fd;
+	volatile uint32_t *regs;
+};
+
+/* `offset` is one of *_REG_OFFSET; the registers are little-endian */
+static inline void calc_mmap_write(struct calc_mmap *calc, unsigned int offset,
+				   uint32_t val)
+{
+	calc->regs[offset / sizeof(uint32_t)] = htole32(val);
+}
+
+static inline uint32_t calc_mmap_read(struct calc_mmap *calc,
+				      unsigned int offset)
+{
+	return le32toh(calc->regs[offset / sizeof(uint32_t)]);
+}
+
+/* Open and map the device at `path`; returns 0 or a negative errno */
+static inline int calc_mmap_open(struct calc_mmap *calc, const char *path)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	void *regs;
+	int err;
+
+	calc->fd = open(path, O_RDWR);
+	if (calc->fd < 0)
+		return -errno;
+
+	regs = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    calc->fd, 0);
+	if (regs == MAP_FAILED) {
+		err = -errno;
+		close(calc->fd);
+		return err;
+	}
+
+	calc->regs = regs;
+	return 0;
+}
+
+static inline void calc_mmap_close(struct calc_mmap *calc)
+{
+	munmap((void *)calc->regs, sysconf(_SC_PAGESIZE));
+	close(calc->fd);
+}
+
+/*
+ * Calculate the result of "`num1` `op` `num2`", like calculate() in
+ * test_app.c. If an error occured, clear it and return its code or 0
+ * elsewhere.
+ */
+static inline int calc_mmap_calculate(struct calc_mmap *calc, int32_t num1,
+				      int32_t num2, uint32_t op,
+				      int32_t *result)
+{
+	uint32_t status;
+
+	calc_mmap_write(calc, DAT0_REG_OFFSET, (uint32_t)num1);
+	calc_mmap_write(calc, DAT1_REG_OFFSET, (uint32_t)num2);
+	/* the operation starts once the operands are in place */
+	__sync_synchronize();
+	calc_mmap_write(calc, OPERATION_REG_OFFSET, op);
+	__sync_synchronize();
+
+	status = calc_mmap_read(calc, STATUS_REG_OFFSET) & STATUS_MASK_ALL;
+	if (status) {
+		calc_mmap_write(calc, STATUS_REG_OFFSET, STATUS_MASK_ALL);
+		return status;
+	}
+
+	*result = (int32_t)calc_mmap_read(calc, RESULT_REG_OFFSET);
+	return 0;
+}
+
+#endif /* _CALC_MMAP_H */
@@ -0,0 +1,47 @@
+#ifndef _CALC_REGS_H
+#define _CALC_REGS_H
+
+#include <linux/io.h>
+#include <linux/types.h>
+#include "calc_driver.h"
+
+/*
+ * Register sequences used by the driver (the register map is shared with
+ * user space in calc_driver.h). They only need the base address, so they are
+ * shared with the KUnit suite (calc_kunit.c), which runs them against
+ * a register block in memory.
+ */
+
+static inline void write_addr(u32 val, void __iomem *addr)
+{
+	writel((u32 __force)cpu_to_le32(val), addr);
+}
+
+static inline u32 read_addr(void __iomem *addr)
+{
+	return le32_to_cpu((__le32 __force)readl(addr));
+}
+
+/* Transfer DAT1_REG->DAT0_REG and write `val` to DAT1_REG; returns old DAT1 */
+static inline u32 calc_push_operand(void __iomem *base, u32 val)
+{
+	u32 old_data_reg1 = read_addr(base + DAT1_REG_OFFSET);
+
+	write_addr(old_data_reg1, base + DAT0_REG_OFFSET);
+	write_addr(val, base + DAT1_REG_OFFSET);
+
+	return old_data_reg1;
+}
+
+/* The status bits are cleared by writing ones to them */
+static inline void calc_clear_status(void __iomem *base)
+{
+	write_addr((u32)STATUS_MASK_ALL, base + STATUS_REG_OFFSET);
+}
+
+static inline u32 calc_status(void __iomem *base)
+{
+	return read_addr(base + STATUS_REG_OFFSET);
+}
+
+#endif /* _CALC_REGS_H */
@@ -0,0 +1,40 @@
+#ifndef _CALC_SW_H
+#define _CALC_SW_H
+
+#include <linux/types.h>
+#include "calc_driver.h"
+
+/*
+ * Software implementation of the operations of the device, which the
+ * dispatcher of the driver runs instead of the hardware. It follows the
+ * device model (scripts/calc_periph.py): the operands are 32-bit unsigned
+ * values, the results wrap around and a failed operation leaves the previous
+ * result in place. Shared with the KUnit suite (calc_kunit.c).
+ *
+ * Returns the new value of the status register.
+ */
+static inline u32 calc_sw_execute(u32 op, u32 dat0, u32 dat1, u32 *result)
+{
+	switch (op) {
+	case ADD:
+		*result = dat0 + dat1;
+		break;
+	case SUB:
+		*result = dat0 - dat1;
+		break;
+	case MUL:
+		*result = dat0 * dat1;
+		break;
+	case DIV:
+		if (!dat1)
+			return STATUS_DIV_ZERO;
+		*result = dat0 / dat1;
+		break;
+	default:
+		return STATUS_INV_OP;
+	}
+
+	return 0;
+}
+
+#endif /* _CALC_SW_H */
@@ -0,0 +1,138 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM calc
+
+#if !defined(_CALC_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CALC_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* clang-format off */
+TRACE_EVENT(calc_read,
+	TP_PROTO(unsigned int minor, u32 offset, u32 value, ssize_t ret),
+	TP_ARGS(minor, offset, value, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u32, offset)
+		__field(u32, value)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->offset = offset;
+		__entry->value = value;
+		__entry->ret = ret;
+	),
+
+	TP_printk("calc-%u offset=0x%02x value=0x%08x ret=%zd",
+		  __entry->minor, __entry->offset, __entry->value, __entry->ret)
+);
+
+/* a write shifts DAT1 to DAT0 and stores the user's value in DAT1 */
+TRACE_EVENT(calc_write,
+	TP_PROTO(unsigned int minor, u32 dat0, u32 dat1, ssize_t ret),
+	TP_ARGS(minor, dat0, dat1, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u32, dat0)
+		__field(u32, dat1)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->dat0 = dat0;
+		__entry->dat1 = dat1;
+		__entry->ret = ret;
+	),
+
+	TP_printk("calc-%u dat0=0x%08x dat1=0x%08x ret=%zd",
+		  __entry->minor, __entry->dat0, __entry->dat1, __entry->ret)
+);
+
+/* `offset` and `value` describe the register accessed by the command */
+TRACE_EVENT(calc_ioctl,
+	TP_PROTO(unsigned int minor, unsigned int cmd, u32 offset, u32 value,
+		 long ret),
+	TP_ARGS(minor, cmd, offset, value, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(unsigned int, cmd)
+		__field(u32, offset)
+		__field(u32, value)
+		__field(long, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->cmd = cmd;
+		__entry->offset = offset;
+		__entry->value = value;
+		__entry->ret = ret;
+	),
+
+	TP_printk("calc-%u cmd=0x%08x offset=0x%02x value=0x%08x ret=%ld",
+		  __entry->minor, __entry->cmd, __entry->offset,
+		  __entry->value, __entry->ret)
+);
+
+/* `latency_ns` is measured for the jobs run by the hardware only */
+TRACE_EVENT(calc_job,
+	TP_PROTO(unsigned int minor, u32 op, bool on_cpu, u32 status,
+		 unsigned long latency_ns),
+	TP_ARGS(minor, op, on_cpu, status, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u32, op)
+		__field(bool, on_cpu)
+		__field(u32, status)
+		__field(unsigned long, latency_ns)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->op = op;
+		__entry->on_cpu = on_cpu;
+		__entry->status = status;
+		__entry->latency_ns = latency_ns;
+	),
+
+	TP_printk("calc-%u op=0x%x path=%s status=0x%x latency_ns=%lu",
+		  __entry->minor, __entry->op, __entry->on_cpu ? "cpu" : "hw",
+		  __entry->status, __entry->latency_ns)
+);
+
+/* a bulk read or write of the streaming mode */
+TRACE_EVENT(calc_stream,
+	TP_PROTO(unsigned int minor, bool write, ssize_t ret),
+	TP_ARGS(minor, write, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(bool, write)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->write = write;
+		__entry->ret = ret;
+	),
+
+	TP_printk("calc-%u %s ret=%zd", __entry->minor,
+		  __entry->write ? "write" : "read", __entry->ret)
+);
+/* clang-format on */
+
+#endif /* _CALC_TRACE_H */
+
+/* the header lives next to the driver, not in include/trace/events */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE calc_trace
+#include <trace/define_trace.h>
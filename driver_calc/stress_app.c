@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+#include "calc_driver.h"
+#include "stress.h"
+
+#define MAX_DEVICES 8
+
+static const char *devices[MAX_DEVICES];
+static unsigned int ndevices;
+/* threads that hold each device open - at most 1 with the "hw" policy */
+static int holders[MAX_DEVICES];
+/* the device allows a single open at a time (its policy is "hw") */
+static int exclusive[MAX_DEVICES];
+
+/*
+ * Open a device, run a single addition on it and close it again. With the
+ * "hw" policy the driver allows a single open at a time, so the other threads
+ * should get -EBUSY. With the other ones their jobs run on the CPU instead.
+ * The operands of one thread should never mix with the ones of another.
+ */
+static int calc_stress_iter(struct stress_thread *thread)
+{
+	unsigned int dev = thread->id % ndevices;
+	int a = rand_r(&thread->seed) & 0xffff;
+	int b = rand_r(&thread->seed) & 0xffff;
+	int ret = STRESS_OK, result = 0;
+	long status = 0;
+	int fd;
+
+	fd = open(devices[dev], O_RDWR);
+	if (fd < 0)
+		return errno == EBUSY ? STRESS_BUSY : STRESS_LOST;
+
+	if (__atomic_add_fetch(&holders[dev], 1, __ATOMIC_SEQ_CST) != 1 &&
+	    exclusive[dev])
+		ret = STRESS_LOST;
+
+	if (write(fd, &a, sizeof(a)) != sizeof(a) ||
+	    write(fd, &b, sizeof(b)) != sizeof(b) ||
+	    ioctl(fd, CALC_IOCTL_CHANGE_OP, ADD) < 0 ||
+	    ioctl(fd, CALC_IOCTL_CHECK_STATUS, &status) < 0 ||
+	    read(fd, &result, sizeof(result)) != sizeof(result))
+		ret = STRESS_LOST;
+	else if ((status & STATUS_MASK_ALL) || result != a + b)
+		ret = STRESS_LOST;
+
+	__atomic_sub_fetch(&holders[dev], 1, __ATOMIC_SEQ_CST);
+	close(fd);
+	return ret;
+}
+
+/* The dispatch policy of /dev/calc-N is in /sys/class/calc_class/calc-N */
+static int is_exclusive(const char *device)
+{
+	char path[128], policy[64] = "";
+	char *name = strdup(device);
+	FILE *file;
+
+	snprintf(path, sizeof(path), "/sys/class/calc_class/%s/policy",
+		 basename(name));
+	free(name);
+
+	file = fopen(path, "r");
+	if (!file)
+		return 1;
+	if (!fgets(policy, sizeof(policy), file))
+		policy[0] = 0;
+	fclose(file);
+
+	return !policy[0] || strstr(policy, "[hw]") != NULL;
+}
+
+static const struct stress_ops calc_stress_ops = {
+	.name = "calc",
+	.iter = calc_stress_iter,
+};
+
+int main(int argc, const char *argv[])
+{
+	unsigned int duration_s = 5;
+	int i;
+
+	if (argc < 2 || argc > MAX_DEVICES + 2) {
+		fprintf(stderr,
+			"usage: %s <duration_s> [char_dev_file...]\n"
+			"e.g. %s 5 /dev/calc-0 /dev/calc-1\n",
+			argv[0], argv[0]);
+		exit(1);
+	}
+	duration_s = strtoul(argv[1], NULL, 0);
+
+	for (i = 2; i < argc; i++)
+		devices[ndevices++] = argv[i];
+	if (!ndevices)
+		devices[ndevices++] = "/dev/calc-0";
+	for (i = 0; i < ndevices; i++)
+		exclusive[i] = is_exclusive(devices[i]);
+
+	return stress_run(&calc_stress_ops, duration_s) ? 1 : 0;
+}
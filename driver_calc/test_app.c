@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -5,8 +6,12 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <libgen.h>
 
 #include "calc_driver.h"
+#include "calc_mmap.h"
 
 /* Calculate the result of "`num1` `op` `num2`".
  * If an error occured, return its code or 0 elsewhere
@@ -29,6 +34,223 @@ int calculate(int fd, long num1, long num2, long op, long *result)
 	return 0;
 }
 
+#define STREAM_PAIRS 300
+
+/* Push many pairs through the streaming mode, with writev/readv and splice */
+static void test_stream(int fd)
+{
+	static int operands[STREAM_PAIRS][2];
+	static struct calc_stream_result results[STREAM_PAIRS];
+	struct iovec iov[2];
+	int pipe_in[2], pipe_out[2];
+	long status = 0;
+	ssize_t len, ret;
+	int i;
+
+	for (i = 0; i < STREAM_PAIRS; i++) {
+		operands[i][0] = i * 1000;
+		operands[i][1] = i % 7;
+	}
+
+	/* a fixed operation is required, and it must be a valid one */
+	assert(ioctl(fd, CALC_IOCTL_STREAM, 100) < 0 && errno == EINVAL);
+	assert(ioctl(fd, CALC_IOCTL_STREAM, DIV) == 0);
+	assert(ioctl(fd, CALC_IOCTL_CHANGE_OP, ADD) < 0 && errno == EBUSY);
+
+	/* the pairs may be split between the buffers */
+	iov[0].iov_base = operands;
+	iov[0].iov_len = 13;
+	iov[1].iov_base = (char *)operands + 13;
+	iov[1].iov_len = sizeof(operands) - 13;
+	assert(writev(fd, iov, 2) == sizeof(operands));
+
+	iov[0].iov_base = results;
+	iov[0].iov_len = sizeof(results) / 2;
+	iov[1].iov_base = (char *)results + sizeof(results) / 2;
+	iov[1].iov_len = sizeof(results) - sizeof(results) / 2;
+	assert(readv(fd, iov, 2) == sizeof(results));
+	assert(read(fd, results, sizeof(results)) == 0);
+
+	for (i = 0; i < STREAM_PAIRS; i++) {
+		if (i % 7 == 0) {
+			assert(results[i].status == STATUS_DIV_ZERO);
+			continue;
+		}
+		assert(results[i].status == 0);
+		assert(results[i].result == i * 1000 / (i % 7));
+	}
+
+	/* the same pairs from a pipe, and the results into another one */
+	assert(ioctl(fd, CALC_IOCTL_STREAM, SUB) == 0);
+	assert(pipe(pipe_in) == 0 && pipe(pipe_out) == 0);
+	assert(write(pipe_in[1], operands, sizeof(operands)) ==
+	       sizeof(operands));
+	for (len = 0; len < sizeof(operands); len += ret) {
+		ret = splice(pipe_in[0], NULL, fd, NULL,
+			     sizeof(operands) - len, 0);
+		assert(ret > 0);
+	}
+	for (len = 0; len < sizeof(results); len += ret) {
+		ret = splice(fd, NULL, pipe_out[1], NULL,
+			     sizeof(results) - len, 0);
+		assert(ret > 0);
+	}
+	assert(read(pipe_out[0], results, sizeof(results)) ==
+	       sizeof(results));
+	for (i = 0; i < STREAM_PAIRS; i++)
+		assert(results[i].status == 0 &&
+		       results[i].result == i * 1000 - i % 7);
+
+	close(pipe_in[0]);
+	close(pipe_in[1]);
+	close(pipe_out[0]);
+	close(pipe_out[1]);
+
+	assert(ioctl(fd, CALC_IOCTL_STREAM, 0) == 0);
+	ioctl(fd, CALC_IOCTL_CHECK_STATUS, &status);
+	assert(!(status & STATUS_MASK_ALL));
+}
+
+/* The same operations done on the mapped registers, if the driver allows it */
+static void test_mmap(const char *path)
+{
+	struct calc_mmap calc;
+	int32_t result;
+	int res;
+
+	res = calc_mmap_open(&calc, path);
+	if (res == -EPERM || res == -ENODEV) {
+		printf("mmap mode disabled - skipped\n");
+		return;
+	}
+	assert(res == 0);
+
+	res = calc_mmap_calculate(&calc, 15, 34, ADD, &result);
+	assert(res == 0 && result == 49);
+	res = calc_mmap_calculate(&calc, 4, 34, MUL, &result);
+	assert(res == 0 && result == 136);
+	res = calc_mmap_calculate(&calc, 2, 0, DIV, &result);
+	assert(res == STATUS_DIV_ZERO);
+	res = calc_mmap_calculate(&calc, 1234, 4321, SUB, &result);
+	assert(res == 0 && result == -3087);
+	res = calc_mmap_calculate(&calc, 6, 5, 100, &result);
+	assert(res == STATUS_INV_OP);
+
+	/* the device is still exclusive while it is mapped */
+	assert(open(path, O_RDWR) < 0 && errno == EBUSY);
+
+	calc_mmap_close(&calc);
+}
+
+/* An attribute of /dev/calc-N, in /sys/class/calc_class/calc-N */
+static FILE *open_attr(const char *dev, const char *attr, const char *mode)
+{
+	char path[128];
+	char *name = strdup(dev);
+
+	snprintf(path, sizeof(path), "/sys/class/calc_class/%s/%s",
+		 basename(name), attr);
+	free(name);
+	return fopen(path, mode);
+}
+
+static long read_attr(const char *dev, const char *attr)
+{
+	FILE *file = open_attr(dev, attr, "r");
+	long value = -1;
+
+	if (file) {
+		if (fscanf(file, "%ld", &value) != 1)
+			value = -1;
+		fclose(file);
+	}
+	return value;
+}
+
+static int write_attr(const char *dev, const char *attr, const char *value)
+{
+	FILE *file = open_attr(dev, attr, "w");
+	int ret;
+
+	if (!file)
+		return -1;
+	ret = fputs(value, file) < 0;
+	if (fclose(file))
+		ret = 1;
+	return ret ? -1 : 0;
+}
+
+#define HYBRID_JOBS 96
+
+/*
+ * Alternate the jobs between the hardware and the CPU - with no latency
+ * allowed, every 16th job of the holder goes to the hardware, the rest to
+ * the CPU. Whichever path a failed job takes, a read still returns the
+ * result of the last successful one.
+ */
+static void test_hybrid(const char *path)
+{
+	char policy[64] = "", latency[16] = "", *name, *end;
+	long hw_jobs, cpu_jobs, err;
+	int fd, i, a, b, op, value, expected = 0;
+	FILE *file;
+
+	file = open_attr(path, "policy", "r");
+	if (!file) {
+		printf("hybrid policy unavailable - skipped\n");
+		return;
+	}
+	assert(fgets(policy, sizeof(policy), file));
+	fclose(file);
+	snprintf(latency, sizeof(latency), "%ld",
+		 read_attr(path, "hybrid_latency_us"));
+	if (write_attr(path, "hybrid_latency_us", "0") ||
+	    write_attr(path, "policy", "hybrid")) {
+		printf("hybrid policy not writable - skipped\n");
+		return;
+	}
+
+	hw_jobs = read_attr(path, "hw_jobs");
+	cpu_jobs = read_attr(path, "cpu_jobs");
+	fd = open(path, O_RDWR);
+	assert(fd > 0);
+
+	/* 16 isn't a multiple of 3, so every kind of job meets both paths */
+	for (i = 0; i < HYBRID_JOBS; i++) {
+		a = i + 1;
+		b = i % 3 == 2 ? 0 : 1000;
+		op = i % 3 == 2 ? DIV : ADD;
+		write(fd, &a, sizeof(a));
+		write(fd, &b, sizeof(b));
+		ioctl(fd, CALC_IOCTL_CHANGE_OP, op);
+
+		err = 0;
+		ioctl(fd, CALC_IOCTL_CHECK_STATUS, &err);
+		if (op == DIV) {
+			assert(err == STATUS_DIV_ZERO);
+			ioctl(fd, CALC_IOCTL_RESET);
+		} else {
+			assert(!(err & STATUS_MASK_ALL));
+			expected = a + b;
+		}
+
+		assert(read(fd, &value, sizeof(value)) == sizeof(value));
+		assert(value == expected);
+	}
+	close(fd);
+
+	assert(read_attr(path, "hw_jobs") > hw_jobs);
+	assert(read_attr(path, "cpu_jobs") > cpu_jobs);
+
+	write_attr(path, "hybrid_latency_us", latency);
+	name = strchr(policy, '[');
+	end = strchr(policy, ']');
+	if (name && end) {
+		*end = 0;
+		write_attr(path, "policy", name + 1);
+	}
+}
+
 static int is_chardev(const char *filename)
 {
 	struct stat file_stat;
@@ -65,6 +287,11 @@ int main(int argc, const char *argv[])
 	res = calculate(fd, 6, 5, 100, &result);
 	assert(res == STATUS_INV_OP);
 
+	test_stream(fd);
 	close(fd);
+
+	test_hybrid(argv[1]);
+
+	test_mmap(argv[1]);
 	return 0;
 }
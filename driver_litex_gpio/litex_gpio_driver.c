@@ -6,28 +6,61 @@
 #include <linux/cdev.h>
 #include <linux/io.h>
 #include <linux/interrupt.h>
-#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/gpio/driver.h>
+#include <linux/irq.h>
+#include <linux/irqdomain.h>
+#include <linux/of.h>
 #include "litex_gpio_driver.h"
+#include "dev_registry.h"
+
+#define CREATE_TRACE_POINTS
+#include "litex_gpio_trace.h"
 
 #define REG_GPIO_STATE 0x0
+/* per pin: 0 - the edge selected in REG_INTERRUPT_EDGE, 1 - any change */
+#define REG_INTERRUPT_MODE 0x4
+/* per pin: 0 - rising edge, 1 - falling edge */
+#define REG_INTERRUPT_EDGE 0x8
 #define REG_INTERRUPT_STATUS 0xc
 #define REG_INTERRUPT_PENDING 0x10
 #define REG_INTERRUPT_ENABLE 0x14
 
-#define GPIO_MAX_MINORS 3
+#define GPIO_MAX_MINORS DEV_REGISTRY_MAX_MINORS
+
+/* number of pins, unless given by the "ngpios" property */
+#define GPIO_DEFAULT_NGPIO 32
+/* the pin (the button) counted by the character device */
+#define GPIO_COUNTER_PIN 0
 
 static int gpio_major;
-static unsigned char gpio_minors[GPIO_MAX_MINORS] = { 0 };
+static DEFINE_DEV_REGISTRY(gpio_registry, GPIO_MAX_MINORS);
 static struct class *gpio_class;
 
 struct gpio_device_data {
 	struct cdev cdev;
 	void *__iomem base;
-	unsigned int counter;
-	spinlock_t counter_lock;
-	struct completion btn_press_completion;
+	/*
+	 * Interrupts of GPIO_COUNTER_PIN, bumped by the hard IRQ handler. Not
+	 * atomic64_t - rv32 has no 64-bit AMOs, so that one takes a spinlock.
+	 */
+	atomic_long_t counter;
+	/* the counter value last returned by read */
+	unsigned long last_read;
+	/* woken up by the IRQ thread once the counter changes */
+	wait_queue_head_t counter_wait;
 	unsigned int opened;
 	spinlock_t open_lock;
+	struct gpio_chip chip;
+	struct irq_domain *domain;
+	/* protects the interrupt configuration below and its registers */
+	raw_spinlock_t irq_lock;
+	/* pins whose interrupts are unmasked by the users of the irq domain */
+	u32 irq_unmasked;
+	u32 irq_mode;
+	u32 irq_edge;
 };
 
 static inline void write_addr(u32 val, void __iomem *addr)
@@ -40,19 +73,52 @@ static inline u32 read_addr(void __iomem *addr)
 	return le32_to_cpu((__le32 __force)readl(addr));
 }
 
+/*
+ * The pins are served by a single (shared) interrupt line. The pending edges
+ * of the pins used by the irq domain are dispatched to their handlers, which
+ * ack them; the rest is acked here. An edge on GPIO_COUNTER_PIN only bumps
+ * the counter - the readers of the character device are woken up from the
+ * IRQ thread, so the time spent with interrupts off doesn't depend on them.
+ */
 static irqreturn_t gpio_irq_handler(int irq, void *dev_id)
 {
 	struct gpio_device_data *gpio_data = dev_id;
-
-	if (read_addr(gpio_data->base + REG_INTERRUPT_PENDING) == 0)
+	irqreturn_t ret = IRQ_HANDLED;
+	unsigned long dispatch;
+	u32 pending, unmasked;
+	unsigned int pin;
+	unsigned long counter = 0;
+
+	unmasked = READ_ONCE(gpio_data->irq_unmasked);
+	pending = read_addr(gpio_data->base + REG_INTERRUPT_PENDING) &
+		  (unmasked | BIT(GPIO_COUNTER_PIN));
+	if (pending == 0) {
+		trace_gpio_irq_handler(irq, pending, 0, IRQ_NONE);
 		return IRQ_NONE;
+	}
+
+	dispatch = pending & unmasked;
+	if (pending & ~unmasked)
+		write_addr(pending & ~unmasked,
+			   gpio_data->base + REG_INTERRUPT_PENDING);
+
+	if (pending & BIT(GPIO_COUNTER_PIN)) {
+		counter = atomic_long_inc_return(&gpio_data->counter);
+		ret = IRQ_WAKE_THREAD;
+	}
+
+	for_each_set_bit(pin, &dispatch, gpio_data->chip.ngpio)
+		generic_handle_irq(irq_find_mapping(gpio_data->domain, pin));
 
-	spin_lock(&gpio_data->counter_lock);
-	gpio_data->counter++;
-	complete(&gpio_data->btn_press_completion);
-	spin_unlock(&gpio_data->counter_lock);
+	trace_gpio_irq_handler(irq, pending, counter, ret);
+	return ret;
+}
+
+static irqreturn_t gpio_irq_thread(int irq, void *dev_id)
+{
+	struct gpio_device_data *gpio_data = dev_id;
 
-	write_addr(1, gpio_data->base + REG_INTERRUPT_PENDING);
+	wake_up_interruptible(&gpio_data->counter_wait);
 	return IRQ_HANDLED;
 }
 
@@ -70,6 +136,10 @@ static int gpio_open(struct inode *inode, struct file *file)
 		gpio_data->opened++;
 	spin_unlock(&gpio_data->open_lock);
 
+	/* the first read waits for an interrupt that comes after the open */
+	if (!ret)
+		gpio_data->last_read = atomic_long_read(&gpio_data->counter);
+
 	return ret;
 }
 
@@ -87,20 +157,29 @@ static ssize_t gpio_read(struct file *file, char __user *buf, size_t count,
 	struct gpio_device_data *gpio_data =
 		(struct gpio_device_data *)file->private_data;
 	int result;
+	unsigned long counter;
 	size_t buf_size = count < (sizeof(result) - *offset) ?
 				  count :
 				  (sizeof(result) - *offset);
 
-	wait_for_completion_interruptible(&gpio_data->btn_press_completion);
-
-	result = gpio_data->counter;
-	if (copy_to_user(buf, &result, sizeof(result)))
+	/* a single wakeup may cover many interrupts */
+	if (wait_event_interruptible(
+		    gpio_data->counter_wait,
+		    (counter = atomic_long_read(&gpio_data->counter)) !=
+			    gpio_data->last_read))
+		return -ERESTARTSYS;
+	gpio_data->last_read = counter;
+
+	/* the user interface is 32-bit - the counter wraps around */
+	result = (int)counter;
+	if (copy_to_user(buf, &result, sizeof(result))) {
+		trace_gpio_read(iminor(file_inode(file)), result, -EFAULT);
 		return -EFAULT;
+	}
 
 	*offset += buf_size;
+	trace_gpio_read(iminor(file_inode(file)), result, buf_size);
 	return buf_size;
-
-	return 0;
 }
 
 static ssize_t gpio_write(struct file *file, const char __user *buf,
@@ -113,20 +192,17 @@ static long gpio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct gpio_device_data *gpio_data =
 		(struct gpio_device_data *)file->private_data;
-	unsigned long flags;
+	unsigned long old;
 
 	switch (cmd) {
 	case GPIO_IOCTL_RESET:
-		spin_lock_irqsave(&gpio_data->counter_lock, flags);
-		gpio_data->counter = 0;
-		reinit_completion(&gpio_data->btn_press_completion);
-		spin_unlock_irqrestore(&gpio_data->counter_lock, flags);
-		break;
+		/* no interrupt is lost between reading and clearing */
+		old = atomic_long_xchg(&gpio_data->counter, 0);
+		gpio_data->last_read = 0;
+		return min_t(unsigned long, old, INT_MAX);
 	default:
 		return -EINVAL;
 	}
-
-	return 0;
 }
 
 static int gpio_release(struct inode *inode, struct file *file)
@@ -140,6 +216,189 @@ static int gpio_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/* The block is input-only, so there's no .set/.set_multiple */
+static int gpio_chip_get_direction(struct gpio_chip *chip, unsigned int offset)
+{
+	return GPIO_LINE_DIRECTION_IN;
+}
+
+static int gpio_chip_direction_input(struct gpio_chip *chip,
+				     unsigned int offset)
+{
+	return 0;
+}
+
+static int gpio_chip_get(struct gpio_chip *chip, unsigned int offset)
+{
+	struct gpio_device_data *gpio_data = gpiochip_get_data(chip);
+
+	return !!(read_addr(gpio_data->base + REG_GPIO_STATE) & BIT(offset));
+}
+
+/* All the requested pins are read with a single register access */
+static int gpio_chip_get_multiple(struct gpio_chip *chip, unsigned long *mask,
+				  unsigned long *bits)
+{
+	struct gpio_device_data *gpio_data = gpiochip_get_data(chip);
+	u32 state = read_addr(gpio_data->base + REG_GPIO_STATE);
+
+	*bits = (*bits & ~*mask) | (state & *mask);
+	return 0;
+}
+
+static int gpio_chip_to_irq(struct gpio_chip *chip, unsigned int offset)
+{
+	struct gpio_device_data *gpio_data = gpiochip_get_data(chip);
+
+	return irq_create_mapping(gpio_data->domain, offset);
+}
+
+/* Write the interrupt configuration; called with irq_lock held */
+static void gpio_irq_write_config(struct gpio_device_data *gpio_data)
+{
+	write_addr(gpio_data->irq_mode, gpio_data->base + REG_INTERRUPT_MODE);
+	write_addr(gpio_data->irq_edge, gpio_data->base + REG_INTERRUPT_EDGE);
+	write_addr(gpio_data->irq_unmasked | BIT(GPIO_COUNTER_PIN),
+		   gpio_data->base + REG_INTERRUPT_ENABLE);
+}
+
+static void gpio_irq_ack(struct irq_data *d)
+{
+	struct gpio_device_data *gpio_data = irq_data_get_irq_chip_data(d);
+
+	write_addr(BIT(irqd_to_hwirq(d)),
+		   gpio_data->base + REG_INTERRUPT_PENDING);
+}
+
+static void gpio_irq_set_masked(struct irq_data *d, bool masked)
+{
+	struct gpio_device_data *gpio_data = irq_data_get_irq_chip_data(d);
+	unsigned long flags;
+	u32 unmasked;
+
+	raw_spin_lock_irqsave(&gpio_data->irq_lock, flags);
+	unmasked = gpio_data->irq_unmasked;
+	if (masked)
+		unmasked &= ~BIT(irqd_to_hwirq(d));
+	else
+		unmasked |= BIT(irqd_to_hwirq(d));
+	WRITE_ONCE(gpio_data->irq_unmasked, unmasked);
+	gpio_irq_write_config(gpio_data);
+	raw_spin_unlock_irqrestore(&gpio_data->irq_lock, flags);
+}
+
+static void gpio_irq_mask(struct irq_data *d)
+{
+	gpio_irq_set_masked(d, true);
+}
+
+static void gpio_irq_unmask(struct irq_data *d)
+{
+	gpio_irq_set_masked(d, false);
+}
+
+/* The block only detects edges */
+static int gpio_irq_set_type(struct irq_data *d, unsigned int type)
+{
+	struct gpio_device_data *gpio_data = irq_data_get_irq_chip_data(d);
+	u32 bit = BIT(irqd_to_hwirq(d));
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gpio_data->irq_lock, flags);
+	switch (type & IRQ_TYPE_SENSE_MASK) {
+	case IRQ_TYPE_EDGE_RISING:
+		gpio_data->irq_mode &= ~bit;
+		gpio_data->irq_edge &= ~bit;
+		break;
+	case IRQ_TYPE_EDGE_FALLING:
+		gpio_data->irq_mode &= ~bit;
+		gpio_data->irq_edge |= bit;
+		break;
+	case IRQ_TYPE_EDGE_BOTH:
+		gpio_data->irq_mode |= bit;
+		break;
+	default:
+		raw_spin_unlock_irqrestore(&gpio_data->irq_lock, flags);
+		return -EINVAL;
+	}
+	gpio_irq_write_config(gpio_data);
+	raw_spin_unlock_irqrestore(&gpio_data->irq_lock, flags);
+
+	return 0;
+}
+
+static struct irq_chip gpio_irq_chip = {
+	.name = "litex-gpio",
+	.irq_ack = gpio_irq_ack,
+	.irq_mask = gpio_irq_mask,
+	.irq_unmask = gpio_irq_unmask,
+	.irq_set_type = gpio_irq_set_type,
+};
+
+static int gpio_irq_domain_map(struct irq_domain *domain, unsigned int virq,
+			       irq_hw_number_t hwirq)
+{
+	irq_set_chip_data(virq, domain->host_data);
+	irq_set_chip_and_handler(virq, &gpio_irq_chip, handle_edge_irq);
+	irq_set_noprobe(virq);
+
+	return 0;
+}
+
+static const struct irq_domain_ops gpio_irq_domain_ops = {
+	.map = gpio_irq_domain_map,
+	.xlate = irq_domain_xlate_twocell,
+};
+
+static void gpio_irq_domain_remove(void *data)
+{
+	struct gpio_device_data *gpio_data = data;
+	unsigned int pin;
+
+	for (pin = 0; pin < gpio_data->chip.ngpio; pin++)
+		irq_dispose_mapping(irq_find_mapping(gpio_data->domain, pin));
+	irq_domain_remove(gpio_data->domain);
+}
+
+/*
+ * Register the pins as a gpio_chip, with their interrupts in a linear irq
+ * domain. The domain is removed only after the chip (devm actions run in
+ * the reverse order), so the chip never hands out stale mappings.
+ */
+static int gpio_chip_register(struct platform_device *pdev,
+			      struct gpio_device_data *data)
+{
+	u32 ngpio = GPIO_DEFAULT_NGPIO;
+	int ret;
+
+	of_property_read_u32(pdev->dev.of_node, "ngpios", &ngpio);
+	if (ngpio == 0 || ngpio > 32)
+		return -EINVAL;
+
+	data->domain = irq_domain_add_linear(pdev->dev.of_node, ngpio,
+					     &gpio_irq_domain_ops, data);
+	if (!data->domain)
+		return -ENOMEM;
+
+	ret = devm_add_action_or_reset(&pdev->dev, gpio_irq_domain_remove,
+				       data);
+	if (ret)
+		return ret;
+
+	data->chip.label = dev_name(&pdev->dev);
+	data->chip.parent = &pdev->dev;
+	data->chip.owner = THIS_MODULE;
+	data->chip.base = -1;
+	data->chip.ngpio = ngpio;
+	data->chip.get_direction = gpio_chip_get_direction;
+	data->chip.direction_input = gpio_chip_direction_input;
+	data->chip.get = gpio_chip_get;
+	data->chip.get_multiple = gpio_chip_get_multiple;
+	data->chip.to_irq = gpio_chip_to_irq;
+
+	return devm_gpiochip_add_data(&pdev->dev, &data->chip, data);
+}
+
 const struct file_operations gpio_fops = { .owner = THIS_MODULE,
 					   .open = gpio_open,
 					   .read = gpio_read,
@@ -147,38 +406,25 @@ const struct file_operations gpio_fops = { .owner = THIS_MODULE,
 					   .unlocked_ioctl = gpio_ioctl,
 					   .release = gpio_release };
 
-static int get_gpio_minor(void)
-{
-	unsigned int i;
-
-	for (i = 0; i < GPIO_MAX_MINORS; i++)
-		if (gpio_minors[i] == 0)
-			return i;
-
-	return -1;
-}
-
 static int gpio_driver_probe(struct platform_device *pdev)
 {
 	struct gpio_device_data *data;
-	unsigned int minor;
+	int minor;
 	long ret, irq;
 	struct resource *mem_res;
 
-	minor = get_gpio_minor();
-	if (minor == -1) {
-		printk(KERN_ERR "gpio_driver: reached max number of devices\n");
-		return -EIO;
-	}
-	gpio_minors[minor] = 1;
-
 	data = devm_kzalloc(&pdev->dev, sizeof(struct gpio_device_data),
 			    GFP_KERNEL);
 	if (!data) {
 		printk(KERN_ERR
 		       "gpio_driver: unable to allocate driver data\n");
-		ret = -ENOMEM;
-		goto err_min_ret;
+		return -ENOMEM;
+	}
+
+	minor = dev_registry_add(&gpio_registry, data);
+	if (minor < 0) {
+		printk(KERN_ERR "gpio_driver: reached max number of devices\n");
+		return minor;
 	}
 
 	cdev_init(&data->cdev, &gpio_fops);
@@ -203,6 +449,20 @@ static int gpio_driver_probe(struct platform_device *pdev)
 		goto err_cdev_del;
 	}
 
+	atomic_long_set(&data->counter, 0);
+	init_waitqueue_head(&data->counter_wait);
+
+	spin_lock_init(&data->open_lock);
+	data->opened = 0;
+
+	raw_spin_lock_init(&data->irq_lock);
+
+	ret = gpio_chip_register(pdev, data);
+	if (ret) {
+		printk(KERN_ERR "gpio_driver: cannot register gpio chip\n");
+		goto err_cdev_del;
+	}
+
 	irq = platform_get_irq(pdev, 0);
 	if (irq < 0) {
 		printk(KERN_ERR "gpio_driver: cannot get irq resource\n");
@@ -210,20 +470,18 @@ static int gpio_driver_probe(struct platform_device *pdev)
 		goto err_cdev_del;
 	}
 
-	ret = devm_request_irq(&pdev->dev, irq, gpio_irq_handler, IRQF_SHARED,
-			       pdev->name, data);
+	ret = devm_request_threaded_irq(&pdev->dev, irq, gpio_irq_handler,
+					gpio_irq_thread, IRQF_SHARED,
+					pdev->name, data);
 	if (ret) {
 		printk(KERN_ERR "gpio_driver: failed to request interrupt\n");
 		goto err_cdev_del;
 	}
 
-	spin_lock_init(&data->counter_lock);
-	data->counter = 0;
-
-	spin_lock_init(&data->open_lock);
-	data->opened = 0;
-
-	init_completion(&data->btn_press_completion);
+	/* all the pins detect rising edges, only the counter pin is enabled */
+	raw_spin_lock_irq(&data->irq_lock);
+	gpio_irq_write_config(data);
+	raw_spin_unlock_irq(&data->irq_lock);
 
 	platform_set_drvdata(pdev, data);
 
@@ -232,8 +490,6 @@ static int gpio_driver_probe(struct platform_device *pdev)
 				 "litex-gpio-%u", minor)))
 		printk(KERN_ERR "gpio_driver: cannot create char device\n");
 
-	write_addr(1, data->base + REG_INTERRUPT_ENABLE);
-
 	printk(KERN_INFO "gpio_driver: successful probe of device: %s\n",
 	       pdev->name);
 	return 0;
@@ -241,7 +497,7 @@ static int gpio_driver_probe(struct platform_device *pdev)
 err_cdev_del:
 	cdev_del(&data->cdev);
 err_min_ret:
-	gpio_minors[minor] = 0;
+	dev_registry_remove(&gpio_registry, minor);
 	return ret;
 }
 
@@ -254,9 +510,8 @@ static int gpio_driver_remove(struct platform_device *pdev)
 	minor = MINOR(data->cdev.dev);
 
 	cdev_del(&data->cdev);
-	gpio_minors[minor] = 0;
-
 	device_destroy(gpio_class, MKDEV(gpio_major, minor));
+	dev_registry_remove(&gpio_registry, minor);
 
 	return 0;
 }
@@ -306,7 +561,7 @@ int init_module(void)
 err_cls:
 	class_destroy(gpio_class);
 err_unreg:
-	unregister_chrdev_region(gpio_major, GPIO_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(gpio_major, 0), GPIO_MAX_MINORS);
 	return ret;
 }
 
@@ -314,9 +569,10 @@ void cleanup_module()
 {
 	printk(KERN_INFO "gpio_driver removal\n");
 
-	unregister_chrdev_region(gpio_major, GPIO_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(gpio_major, 0), GPIO_MAX_MINORS);
 	platform_driver_unregister(&gpio_driver);
 	class_destroy(gpio_class);
+	dev_registry_destroy(&gpio_registry);
 }
 
 MODULE_LICENSE("GPL");
@@ -1,6 +1,7 @@
 #ifndef _GPIO_DRIVER_H
 #define _GPIO_DRIVER_H
 
+/* Clears the counter and returns its previous value (up to INT_MAX) */
 #define GPIO_IOCTL_RESET _IO('G', 0)
 
 #endif
\ No newline at end of file
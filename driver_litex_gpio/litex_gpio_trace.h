@@ -0,0 +1,69 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM litex_gpio
+
+#if !defined(_LITEX_GPIO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LITEX_GPIO_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/irqreturn.h>
+
+/* clang-format off */
+/* the format file gets the values, which perf and libtraceevent can resolve */
+TRACE_DEFINE_ENUM(IRQ_NONE);
+TRACE_DEFINE_ENUM(IRQ_HANDLED);
+TRACE_DEFINE_ENUM(IRQ_WAKE_THREAD);
+
+TRACE_EVENT(gpio_irq_handler,
+	TP_PROTO(int irq, u32 pending, unsigned int counter, int ret),
+	TP_ARGS(irq, pending, counter, ret),
+
+	TP_STRUCT__entry(
+		__field(int, irq)
+		__field(u32, pending)
+		__field(unsigned int, counter)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->pending = pending;
+		__entry->counter = counter;
+		__entry->ret = ret;
+	),
+
+	TP_printk("irq=%d pending=0x%x counter=%u ret=%s", __entry->irq,
+		  __entry->pending, __entry->counter,
+		  __print_symbolic(__entry->ret,
+				   { IRQ_NONE, "none" },
+				   { IRQ_HANDLED, "handled" },
+				   { IRQ_WAKE_THREAD, "wake_thread" }))
+);
+
+TRACE_EVENT(gpio_read,
+	TP_PROTO(unsigned int minor, unsigned int counter, ssize_t ret),
+	TP_ARGS(minor, counter, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(unsigned int, counter)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->counter = counter;
+		__entry->ret = ret;
+	),
+
+	TP_printk("litex-gpio-%u counter=%u ret=%zd", __entry->minor,
+		  __entry->counter, __entry->ret)
+);
+/* clang-format on */
+
+#endif /* _LITEX_GPIO_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE litex_gpio_trace
+#include <trace/define_trace.h>
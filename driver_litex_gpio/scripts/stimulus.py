@@ -0,0 +1,93 @@
+# Drives an input pin of a LiteX GPIO model with a generated pulse train.
+#
+# The pulses come at `rate_hz`, in bursts of `burst` pulses (0 - a single,
+# continuous train) separated by additional `gap_ms` of silence. Every rising
+# edge is moved by a pseudo-random jitter of up to +-`jitter_us`, and the
+# pulses stay high for a quarter of the period. The jitter comes from
+# a xorshift32 generator seeded with `seed`, so a given set of parameters
+# always gives the same edges - the analysis mode of test_app.c computes them
+# the same way (stim_edge_us) and compares them with the interrupts it got.
+#
+# The edges are applied on the emulation's virtual time, so a run doesn't
+# depend on how fast the host is.
+
+from System import Action
+from Antmicro.Renode.Time import TimeInterval
+
+
+def gpio_stimulus_xorshift32(x):
+    x ^= (x << 13) & 0xFFFFFFFF
+    x ^= x >> 17
+    x ^= (x << 5) & 0xFFFFFFFF
+    return x
+
+
+class GpioStimulus(object):
+    def __init__(self, count, rate_hz, burst, gap_ms, jitter_us, seed):
+        self.count = count
+        self.period_us = 1000000 // rate_hz
+        self.burst = burst if burst else count
+        self.gap_us = gap_ms * 1000
+        # the pulses must not overlap
+        self.jitter_us = min(jitter_us, self.period_us // 4)
+        self.width_us = max(self.period_us // 4, 1)
+        self.rand = seed if seed else 1
+
+    # time of the i-th rising edge, counted from the start of the train
+    def edge_us(self, i):
+        nominal = ((i // self.burst) *
+                   (self.burst * self.period_us + self.gap_us) +
+                   (i % self.burst) * self.period_us)
+        if not self.jitter_us:
+            return nominal
+        self.rand = gpio_stimulus_xorshift32(self.rand)
+        span = 2 * self.jitter_us + 1
+        # only the first edge can be moved before the start
+        return max(nominal + self.rand % span - self.jitter_us, 0)
+
+
+def mc_gpio_stimulus(port, pin, count, rate_hz, burst=0, gap_ms=0,
+                     jitter_us=0, seed=1, delay_ms=0):
+    machine = monitor.Machine
+    found, gpio = machine.TryGetByName(str(port))
+    if not found:
+        print("gpio_stimulus: no such peripheral: %s" % port)
+        return
+
+    pin = int(pin)
+    stim = GpioStimulus(int(count), int(rate_hz), int(burst), int(gap_ms),
+                        int(jitter_us), int(seed))
+    if stim.count <= 0 or stim.period_us <= 0:
+        print("gpio_stimulus: nothing to generate")
+        return
+
+    # the edges are handled in time order: rise(0), fall(0), rise(1), ...
+    state = {"index": 0, "high": False, "now": 0,
+             "next_rise": stim.edge_us(0)}
+
+    def schedule(at_us):
+        delay = TimeInterval.FromMicroseconds(at_us - state["now"])
+        state["now"] = at_us
+        machine.ScheduleAction(delay, Action[TimeInterval](step))
+
+    def step(time):
+        if not state["high"]:
+            gpio.OnGPIO(pin, True)
+            state["high"] = True
+            schedule(state["next_rise"] + stim.width_us)
+            return
+
+        gpio.OnGPIO(pin, False)
+        state["high"] = False
+        state["index"] += 1
+        if state["index"] == stim.count:
+            print("gpio_stimulus: %d pulses done" % stim.count)
+            return
+        state["next_rise"] = stim.edge_us(state["index"])
+        schedule(state["next_rise"])
+
+    state["now"] = -int(delay_ms) * 1000
+    schedule(state["next_rise"])
+
+    print("gpio_stimulus: %d pulses on %s@%d at %s Hz" %
+          (stim.count, port, pin, rate_hz))
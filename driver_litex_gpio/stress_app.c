@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <stdlib.h>
+
+#include "litex_gpio_driver.h"
+#include "stress.h"
+
+#define MAX_DEVICES 8
+
+static const char *devices[MAX_DEVICES];
+static unsigned int ndevices;
+/* number of threads that hold each device open - never more than 1 */
+static int holders[MAX_DEVICES];
+/* in the read mode the threads wait for the interrupts, too */
+static int read_mode;
+/* the last counter value seen by the thread that holds each device */
+static unsigned int last_counter[MAX_DEVICES];
+
+static int gpio_stress_open(struct stress_thread *thread, unsigned int dev)
+{
+	thread->fd = open(devices[dev], O_RDONLY);
+	if (thread->fd < 0)
+		return errno == EBUSY ? STRESS_BUSY : STRESS_LOST;
+
+	if (__atomic_add_fetch(&holders[dev], 1, __ATOMIC_SEQ_CST) != 1)
+		return STRESS_LOST;
+
+	if (ioctl(thread->fd, GPIO_IOCTL_RESET) < 0)
+		return STRESS_LOST;
+	last_counter[dev] = 0;
+
+	return STRESS_OK;
+}
+
+static void gpio_stress_close(struct stress_thread *thread, unsigned int dev)
+{
+	if (thread->fd < 0)
+		return;
+
+	__atomic_sub_fetch(&holders[dev], 1, __ATOMIC_SEQ_CST);
+	close(thread->fd);
+	thread->fd = -1;
+}
+
+/*
+ * In the default mode, the threads compete for the devices: each iteration
+ * opens a device, resets its counter and closes it. In the read mode, the
+ * thread that opened a device keeps it and reads the interrupt counter, which
+ * must never go back - otherwise an increment done by the interrupt handler
+ * was lost. The read mode needs the buttons to be pressed, e.g. with:
+ * (machine-0) watch "gpio_in_1.button_1 PressAndRelease" 100
+ */
+static int gpio_stress_iter(struct stress_thread *thread)
+{
+	unsigned int dev = thread->id % ndevices;
+	unsigned int counter;
+	int ret;
+
+	if (!read_mode) {
+		ret = gpio_stress_open(thread, dev);
+		gpio_stress_close(thread, dev);
+		return ret;
+	}
+
+	if (thread->fd < 0) {
+		ret = gpio_stress_open(thread, dev);
+		if (ret != STRESS_OK) {
+			if (ret == STRESS_LOST)
+				gpio_stress_close(thread, dev);
+			return ret;
+		}
+	}
+
+	if (read(thread->fd, &counter, sizeof(counter)) != sizeof(counter))
+		return STRESS_LOST;
+	if (counter == 0 || counter < last_counter[dev])
+		return STRESS_LOST;
+	last_counter[dev] = counter;
+
+	return STRESS_OK;
+}
+
+static void gpio_stress_fini(struct stress_thread *thread)
+{
+	gpio_stress_close(thread, thread->id % ndevices);
+}
+
+static const struct stress_ops gpio_stress_ops = {
+	.name = "litex_gpio",
+	.iter = gpio_stress_iter,
+	.fini = gpio_stress_fini,
+};
+
+int main(int argc, const char *argv[])
+{
+	unsigned int duration_s;
+	int i;
+
+	if (argc < 3 || argc > MAX_DEVICES + 3 ||
+	    (strcmp(argv[2], "open") && strcmp(argv[2], "read"))) {
+		fprintf(stderr,
+			"usage: %s <duration_s> <open|read> [char_dev...]\n"
+			"e.g. %s 5 open /dev/litex-gpio-0 /dev/litex-gpio-1\n",
+			argv[0], argv[0]);
+		exit(1);
+	}
+	duration_s = strtoul(argv[1], NULL, 0);
+	read_mode = !strcmp(argv[2], "read");
+
+	for (i = 3; i < argc; i++)
+		devices[ndevices++] = argv[i];
+	if (!ndevices)
+		devices[ndevices++] = "/dev/litex-gpio-0";
+
+	return stress_run(&gpio_stress_ops, duration_s) ? 1 : 0;
+}
@@ -2,11 +2,37 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include "litex_gpio_driver.h"
 
+/* the stimulus is started by hand, so the first edge may take a while */
+#define FIRST_EDGE_TIMEOUT_S 60
+/* the train is considered finished after this long without an interrupt */
+#define IDLE_TIMEOUT_S 2
+
+/* Parameters of the pulse train, as given to scripts/stimulus.py */
+struct stim_config {
+	unsigned int count;
+	unsigned int rate_hz;
+	unsigned int burst;
+	unsigned int gap_ms;
+	unsigned int jitter_us;
+	unsigned int seed;
+};
+
+/* The counter value returned by a read and the time it returned at */
+struct gpio_event {
+	unsigned int counter;
+	long long time_ns;
+};
+
+static volatile sig_atomic_t timed_out;
+
 static void count_until(int gpio_dev_fd, unsigned int limit)
 {
 	unsigned int current = 0;
@@ -17,6 +43,170 @@ static void count_until(int gpio_dev_fd, unsigned int limit)
 	}
 }
 
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int stim_xorshift32(unsigned int x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/*
+ * Times (in us, from the start of the train) of all the rising edges made by
+ * scripts/stimulus.py for the given parameters - keep both in sync.
+ */
+static long long *stim_edges_us(const struct stim_config *cfg)
+{
+	unsigned int period_us = 1000000 / cfg->rate_hz;
+	unsigned int burst = cfg->burst ? cfg->burst : cfg->count;
+	unsigned int jitter_us = cfg->jitter_us;
+	unsigned int rand = cfg->seed ? cfg->seed : 1;
+	long long *edges, nominal;
+	unsigned int i;
+
+	/* the pulses must not overlap */
+	if (jitter_us > period_us / 4)
+		jitter_us = period_us / 4;
+
+	edges = calloc(cfg->count, sizeof(*edges));
+	assert(edges);
+
+	for (i = 0; i < cfg->count; i++) {
+		nominal = (long long)(i / burst) *
+				  (burst * period_us + cfg->gap_ms * 1000LL) +
+			  (i % burst) * period_us;
+		if (jitter_us) {
+			rand = stim_xorshift32(rand);
+			nominal += (long long)(rand % (2 * jitter_us + 1)) -
+				   jitter_us;
+		}
+		/* only the first edge can be moved before the start */
+		edges[i] = nominal > 0 ? nominal : 0;
+	}
+
+	return edges;
+}
+
+static void on_alarm(int sig)
+{
+	timed_out = 1;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long la = *(const long long *)a, lb = *(const long long *)b;
+
+	return (la > lb) - (la < lb);
+}
+
+static long long percentile(const long long *sorted, unsigned int n,
+			    unsigned int pct)
+{
+	return n ? sorted[(unsigned long long)(n - 1) * pct / 100] : 0;
+}
+
+/*
+ * Count the interrupts caused by the pulse train of scripts/stimulus.py and
+ * print a single JSON line comparing them with the generated edges:
+ * - received/lost - interrupts counted by the driver and the edges that
+ *   never made it, e.g. because the previous one was still pending,
+ * - wakeups - reads that returned a new counter value; a wakeup may cover
+ *   several interrupts,
+ * - gen_rate_hz/irq_rate_hz - average rate of the edges and the rate at which
+ *   the driver actually counted them,
+ * - lat_*_us - delay between an edge and the read that reported it. The clock
+ *   of the stimulus isn't known, so the delays are relative to the fastest
+ *   wakeup (so there's no lat_min_us), which makes them a measure of the
+ *   latency jitter. The N-th interrupt is matched with the N-th edge.
+ */
+static int analyze(int fd, const struct stim_config *cfg)
+{
+	struct sigaction sa = { .sa_handler = on_alarm };
+	unsigned int counter, prev = 0, nevents = 0, nlat = 0, i, lost;
+	long long *edges, *latencies, base = 0, span;
+	long long gen_rate_hz = 0, irq_rate_hz = 0;
+	struct gpio_event *events;
+
+	edges = stim_edges_us(cfg);
+	events = calloc(cfg->count, sizeof(*events));
+	latencies = calloc(cfg->count, sizeof(*latencies));
+	assert(events && latencies);
+
+	/* no SA_RESTART - the alarm has to interrupt a blocked read */
+	sigaction(SIGALRM, &sa, NULL);
+
+	ioctl(fd, GPIO_IOCTL_RESET);
+	printf("waiting for %u edges at %u Hz...\n", cfg->count, cfg->rate_hz);
+	fflush(stdout);
+
+	alarm(FIRST_EDGE_TIMEOUT_S);
+	while (prev < cfg->count) {
+		if (read(fd, &counter, sizeof(counter)) != sizeof(counter) ||
+		    timed_out)
+			break;
+		if (counter <= prev)
+			continue;
+
+		events[nevents].counter = counter;
+		events[nevents].time_ns = now_ns();
+		nevents++;
+		prev = counter;
+		alarm(IDLE_TIMEOUT_S);
+	}
+	alarm(0);
+
+	if (!nevents) {
+		fprintf(stderr, "litex_gpio: no interrupts received\n");
+		return 1;
+	}
+
+	for (i = 0; i < nevents; i++) {
+		if (events[i].counter > cfg->count)
+			break;
+		latencies[nlat] = events[i].time_ns -
+				  edges[events[i].counter - 1] * 1000;
+		if (!nlat || latencies[nlat] < base)
+			base = latencies[nlat];
+		nlat++;
+	}
+	for (i = 0; i < nlat; i++)
+		latencies[i] -= base;
+	qsort(latencies, nlat, sizeof(*latencies), cmp_ll);
+
+	lost = prev < cfg->count ? cfg->count - prev : 0;
+	span = edges[cfg->count - 1] - edges[0];
+	if (span > 0)
+		gen_rate_hz = (cfg->count - 1) * 1000000LL / span;
+	span = events[nevents - 1].time_ns - events[0].time_ns;
+	if (span > 0)
+		irq_rate_hz = (long long)(prev - events[0].counter) *
+			      1000000000LL / span;
+
+	printf("{\"driver\": \"litex_gpio\", \"generated\": %u, "
+	       "\"received\": %u, \"lost\": %u, \"wakeups\": %u, "
+	       "\"gen_rate_hz\": %lld, \"irq_rate_hz\": %lld, "
+	       "\"lat_p50_us\": %lld, \"lat_p90_us\": %lld, "
+	       "\"lat_p99_us\": %lld, \"lat_max_us\": %lld}\n",
+	       cfg->count, prev, lost, nevents, gen_rate_hz, irq_rate_hz,
+	       percentile(latencies, nlat, 50) / 1000,
+	       percentile(latencies, nlat, 90) / 1000,
+	       percentile(latencies, nlat, 99) / 1000,
+	       nlat ? latencies[nlat - 1] / 1000 : 0);
+
+	free(latencies);
+	free(events);
+	free(edges);
+	return 0;
+}
+
 static int is_chardev(const char *filename)
 {
 	struct stat file_stat;
@@ -27,11 +217,18 @@ static int is_chardev(const char *filename)
 
 int main(int argc, const char *argv[])
 {
-	int fd;
+	struct stim_config cfg = { .seed = 1 };
+	int fd, analyze_mode;
 	unsigned int limit = 7;
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s <char_dev_file>\n", argv[0]);
+	analyze_mode = argc > 2 && !strcmp(argv[2], "analyze");
+	if ((!analyze_mode && argc != 2) ||
+	    (analyze_mode && (argc < 5 || argc > 9))) {
+		fprintf(stderr,
+			"usage: %s <char_dev_file>\n"
+			"       %s <char_dev_file> analyze <count> <rate_hz> "
+			"[burst] [gap_ms] [jitter_us] [seed]\n",
+			argv[0], argv[0]);
 		exit(1);
 	}
 	if (!is_chardev(argv[1])) {
@@ -42,10 +239,26 @@ int main(int argc, const char *argv[])
 	fd = open(argv[1], O_RDWR);
 	assert(fd > 0);
 
+	if (analyze_mode) {
+		cfg.count = strtoul(argv[3], NULL, 0);
+		cfg.rate_hz = strtoul(argv[4], NULL, 0);
+		if (argc > 5)
+			cfg.burst = strtoul(argv[5], NULL, 0);
+		if (argc > 6)
+			cfg.gap_ms = strtoul(argv[6], NULL, 0);
+		if (argc > 7)
+			cfg.jitter_us = strtoul(argv[7], NULL, 0);
+		if (argc > 8)
+			cfg.seed = strtoul(argv[8], NULL, 0);
+		assert(cfg.count > 0 && cfg.rate_hz > 0);
+
+		return analyze(fd, &cfg);
+	}
+
 	while (1) {
 		count_until(fd, limit);
-		printf("Counter reached %d, resetting...\n", limit);
-		ioctl(fd, GPIO_IOCTL_RESET);
+		printf("Counter reached %d, resetting...\n",
+		       ioctl(fd, GPIO_IOCTL_RESET));
 	}
 
 	return 0;
@@ -0,0 +1,71 @@
+# Replays a recorded temperature/humidity series into the SI70xx models.
+#
+# Every non-empty line of the CSV file holds a single sample as
+# `temperature,humidity` pairs - either one pair, which is fed to all the
+# sensors, or one pair per sensor, in the order of SENSORS. Lines that don't
+# start with a number (e.g. a header) are skipped.
+#
+# The samples are applied on the emulation's virtual time, so a replay is
+# exactly the same on every run, no matter how fast the host is.
+
+from System import Action, Decimal
+from Antmicro.Renode.Time import TimeInterval
+
+SENSORS = ["sysbus.i2c0.si7021_0", "sysbus.i2c1.si7021_1"]
+
+
+def si7021_load_trace(path):
+    samples = []
+    with open(path) as trace:
+        for line in trace:
+            fields = [f.strip() for f in line.split(",")]
+            try:
+                values = [float(f) for f in fields if f]
+            except ValueError:
+                continue
+            if not values or len(values) % 2:
+                continue
+            samples.append(values)
+    return samples
+
+
+def si7021_apply_sample(sensors, values):
+    for i, sensor in enumerate(sensors):
+        pair = (i * 2) % len(values)
+        sensor.Temperature = Decimal(values[pair])
+        sensor.Humidity = Decimal(values[pair + 1])
+
+
+def mc_si7021_replay(path, rate_hz, loop=1):
+    machine = monitor.Machine
+    samples = si7021_load_trace(str(path))
+    period = TimeInterval.FromMicroseconds(int(1000000 / float(rate_hz)))
+    loop = int(loop) != 0
+    state = {"index": 0}
+
+    sensors = []
+    for name in SENSORS:
+        found, sensor = machine.TryGetByName(name)
+        if found:
+            sensors.append(sensor)
+
+    if not samples or not sensors:
+        print("si7021_replay: nothing to replay")
+        return
+
+    def step(time):
+        si7021_apply_sample(sensors, samples[state["index"]])
+        state["index"] += 1
+        if state["index"] == len(samples):
+            if not loop:
+                return
+            state["index"] = 0
+        machine.ScheduleAction(period, Action[TimeInterval](step))
+
+    si7021_apply_sample(sensors, samples[0])
+    state["index"] = 1 % len(samples)
+    if len(samples) > 1 or loop:
+        machine.ScheduleAction(period, Action[TimeInterval](step))
+
+    print("si7021_replay: %d samples from %s at %s Hz" %
+          (len(samples), path, rate_hz))
@@ -0,0 +1,89 @@
+#ifndef _SI7021_CONV_H
+#define _SI7021_CONV_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include "si7021_driver.h"
+
+/*
+ * Conversions of the raw codes and the resolution timings of the sensor.
+ * They don't touch the device, so they are kept apart from the driver and
+ * shared with the KUnit suite (si7021_kunit.c), which runs them on the build
+ * host.
+ */
+
+/* Raw RH and temperature codes, as returned by the device */
+struct si7021_raw {
+	unsigned short temp;
+	unsigned short rl_hum;
+};
+
+/*
+ * Max conversion time of a RH measurement followed by a temperature
+ * measurement for each resolution setting, ordered from the finest to the
+ * coarsest one.
+ */
+static const struct {
+	u8 res;
+	unsigned int conv_us;
+} si7021_res_timings[] = {
+	{ SI7021_RES_RH12_T14, 12000 + 10800 },
+	{ SI7021_RES_RH10_T13, 4500 + 6200 },
+	{ SI7021_RES_RH11_T11, 7000 + 2400 },
+	{ SI7021_RES_RH8_T12, 3100 + 3800 },
+};
+
+static inline unsigned int si7021_conv_time_us(u8 res)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(si7021_res_timings); i++)
+		if (si7021_res_timings[i].res == res)
+			return si7021_res_timings[i].conv_us;
+
+	return si7021_res_timings[0].conv_us;
+}
+
+/*
+ * Pick the finest resolution that can be sampled every `period_us`, given
+ * the I2C overhead of a measurement; returns an index of si7021_res_timings
+ */
+static inline unsigned int si7021_res_for_period(unsigned int period_us,
+						 unsigned int overhead_us)
+{
+	unsigned int i, sample_us;
+
+	for (i = 0; i < ARRAY_SIZE(si7021_res_timings) - 1; i++) {
+		sample_us = si7021_res_timings[i].conv_us + overhead_us;
+		if (sample_us <= period_us)
+			break;
+	}
+
+	return i;
+}
+
+static inline void si7021_raw_to_result(const struct si7021_raw *raw,
+					struct si7021_result *result)
+{
+	result->temp = (((int)raw->temp * 17572) / 65536 - 4685) / 100;
+
+	/* The relative humidity value must be in range <0,100> */
+	result->rl_hum = clamp_val(raw->rl_hum, 3146, 55575);
+	result->rl_hum = ((unsigned int)result->rl_hum * 125) / 65536 - 6;
+}
+
+/* temperature in millidegrees Celsius */
+static inline long si7021_raw_to_temp_mc(const struct si7021_raw *raw)
+{
+	return (long)(((u64)raw->temp * 175720) >> 16) - 46850;
+}
+
+/* relative humidity in milli-percent */
+static inline long si7021_raw_to_hum_mpct(const struct si7021_raw *raw)
+{
+	long rl_hum = (long)(((u64)raw->rl_hum * 125000) >> 16) - 6000;
+
+	return clamp_val(rl_hum, 0, 100000);
+}
+
+#endif /* _SI7021_CONV_H */
@@ -4,9 +4,24 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/hwmon.h>
+#include <linux/list.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 #include "si7021_driver.h"
+#include "si7021_conv.h"
+#include "dev_registry.h"
 
-#define SI7021_MAX_MINORS 2
+#define CREATE_TRACE_POINTS
+#include "si7021_trace.h"
+
+#define SI7021_MAX_MINORS DEV_REGISTRY_MAX_MINORS
+/* the minor of the "si7021-all" node, right after the per-sensor ones */
+#define SI7021_ALL_MINOR SI7021_MAX_MINORS
 
 #define SI7021_CMD_RESET 0xFE
 #define SI7021_CMD_TEMP_MEASURE 0xE3
@@ -18,15 +33,42 @@
 #define SI7021_CMD_WRITE_HEATER_REG 0x51
 #define SI7021_CMD_READ_HEATER_REG 0x11
 
+/* powerup time after issuing a software reset command */
+#define SI7021_RESET_TIME_MS 15
+
+#define SI7021_DEFAULT_UPDATE_INTERVAL 1000
+#define SI7021_MAX_UPDATE_INTERVAL 60000
+
 static int si7021_major;
-static unsigned char si7021_minors[SI7021_MAX_MINORS] = { 0 };
+/* probes run asynchronously, so the minors can be allocated concurrently */
+static DEFINE_DEV_REGISTRY(si7021_registry, SI7021_MAX_MINORS);
 static struct class *si7021_class;
+static struct cdev si7021_all_cdev;
+
+/* all the probed sensors, swept by reads of the "si7021-all" node */
+static LIST_HEAD(si7021_devices);
+static DECLARE_RWSEM(si7021_devices_sem);
 
 struct si7021_data {
 	struct cdev cdev;
-	unsigned long flags;
-#define SI7021_BUSY_BIT_POS 0
 	struct i2c_client *client;
+	struct list_head node;
+	/* serializes the command sequences sent to the device */
+	struct mutex lock;
+	/* incremented (under lock) each time a measurement completes */
+	unsigned int meas_seq;
+	int meas_ret;
+	struct si7021_raw meas_raw;
+	unsigned long meas_time;
+	ktime_t meas_timestamp;
+	/* max age (in ms) of a cached measurement served through hwmon */
+	unsigned int update_interval;
+	/* currently programmed SI7021_RES_* value */
+	u8 res;
+	/* running average of the time spent on I2C on top of conversions */
+	unsigned int xfer_overhead_us;
+	/* the device doesn't accept commands before it powers up after reset */
+	ktime_t ready_time;
 };
 
 static int si7021_send(struct i2c_client *client, char *buf, unsigned int size)
@@ -37,10 +79,13 @@ static int si7021_send(struct i2c_client *client, char *buf, unsigned int size)
 	return ret;
 }
 
+/* `cmd` is in CPU order, two-byte commands are sent MSB first */
 static int si7021_send_cmd(struct i2c_client *client, u16 cmd,
 			   unsigned int size)
 {
-	return si7021_send(client, (char *)&cmd, size);
+	u8 buf[2] = { cmd >> 8, cmd & 0xff };
+
+	return si7021_send(client, (char *)buf + sizeof(buf) - size, size);
 }
 
 static int si7021_recv(struct i2c_client *client, char *buf, unsigned int size)
@@ -57,10 +102,29 @@ static int si7021_cmd_xfer(struct i2c_client *client, u16 cmd,
 {
 	int ret;
 
+	trace_si7021_cmd_xfer_start(client, cmd, cmd_size, rx_size, 0);
+
 	ret = si7021_send_cmd(client, cmd, cmd_size);
-	if (ret < 0)
-		return ret;
-	return si7021_recv(client, rx_buf, rx_size);
+	if (ret >= 0)
+		ret = si7021_recv(client, rx_buf, rx_size);
+
+	trace_si7021_cmd_xfer(client, cmd, cmd_size, rx_size, ret);
+	return ret;
+}
+
+static void si7021_set_reset_deadline(struct si7021_data *si7021_data)
+{
+	si7021_data->ready_time =
+		ktime_add_ms(ktime_get(), SI7021_RESET_TIME_MS);
+}
+
+/* Must be called with the lock held, before sending any command */
+static void si7021_wait_ready(struct si7021_data *si7021_data)
+{
+	s64 remaining_us = ktime_us_delta(si7021_data->ready_time, ktime_get());
+
+	if (remaining_us > 0)
+		usleep_range(remaining_us, remaining_us + 1000);
 }
 
 static int si7021_set_reg_value(struct i2c_client *client, u8 cmd, u8 reg_val)
@@ -69,50 +133,154 @@ static int si7021_set_reg_value(struct i2c_client *client, u8 cmd, u8 reg_val)
 	return si7021_send(client, (char *)&reg_cmd, sizeof(reg_cmd));
 }
 
+static void si7021_update_overhead(struct si7021_data *si7021_data,
+				   s64 elapsed_us)
+{
+	s64 overhead = elapsed_us - si7021_conv_time_us(si7021_data->res);
+
+	if (overhead < 0)
+		overhead = 0;
+
+	if (!si7021_data->xfer_overhead_us)
+		si7021_data->xfer_overhead_us = overhead;
+	else
+		si7021_data->xfer_overhead_us =
+			(3 * si7021_data->xfer_overhead_us + overhead) / 4;
+}
+
+static int si7021_set_rate(struct si7021_data *si7021_data,
+			   struct si7021_rate *rate)
+{
+	struct i2c_client *client = si7021_data->client;
+	unsigned int i;
+	u8 reg;
+	int ret;
+
+	if (!rate->rate_mhz)
+		return -EINVAL;
+
+	i = si7021_res_for_period(1000000000 / rate->rate_mhz,
+				   si7021_data->xfer_overhead_us);
+
+	ret = si7021_cmd_xfer(client, SI7021_CMD_READ_USER_REG, sizeof(u8),
+			      &reg, sizeof(reg));
+	if (ret < 0)
+		return ret;
+
+	reg = (reg & ~SI7021_USER_REG_RES_MASK) | si7021_res_timings[i].res;
+	ret = si7021_set_reg_value(client, SI7021_CMD_WRITE_USER_REG, reg);
+	if (ret < 0)
+		return ret;
+
+	si7021_data->res = si7021_res_timings[i].res;
+	rate->res = si7021_data->res;
+	rate->eff_rate_mhz = 1000000000 / (si7021_res_timings[i].conv_us +
+					   si7021_data->xfer_overhead_us);
+
+	return 0;
+}
+
 static int si7021_open(struct inode *inode, struct file *file)
 {
 	struct si7021_data *si7021_data =
 		container_of(inode->i_cdev, struct si7021_data, cdev);
 
-	if (test_and_set_bit(SI7021_BUSY_BIT_POS, &si7021_data->flags))
-		return -EBUSY;
-
 	file->private_data = si7021_data;
 
 	return 0;
 }
 
-static ssize_t si7021_read(struct file *file, char __user *buf, size_t count,
-			   loff_t *offset)
+static int si7021_measure(struct si7021_data *si7021_data,
+			  struct si7021_raw *raw)
 {
-	struct si7021_data *si7021_data =
-		(struct si7021_data *)file->private_data;
-	struct si7021_result result;
-	unsigned short temp_raw;
 	int ret;
 
 	ret = si7021_cmd_xfer(si7021_data->client, SI7021_CMD_TEMP_MEASURE,
-			      sizeof(u8), (char *)&temp_raw, sizeof(temp_raw));
+			      sizeof(u8), (char *)&raw->temp,
+			      sizeof(raw->temp));
 	if (ret < 0)
 		return ret;
-
-	temp_raw = be16_to_cpu(temp_raw);
-	result.temp = (((int)temp_raw * 17572) / 65536 - 4685) / 100;
+	raw->temp = be16_to_cpu(raw->temp);
 
 	ret = si7021_cmd_xfer(si7021_data->client, SI7021_CMD_HUMI_MEASURE,
-			      sizeof(u8), (char *)&result.rl_hum,
-			      sizeof(result.rl_hum));
+			      sizeof(u8), (char *)&raw->rl_hum,
+			      sizeof(raw->rl_hum));
 	if (ret < 0)
 		return ret;
+	raw->rl_hum = be16_to_cpu(raw->rl_hum);
+
+	return 0;
+}
+
+/*
+ * Readers that had to wait for the lock while another conversion was in
+ * progress don't start a new one - they share the result of the conversion
+ * that completed in the meantime. This way N concurrent readers cost a single
+ * conversion instead of N. A measurement younger than `max_age` jiffies is
+ * also returned without talking to the device. If `timestamp` is not NULL,
+ * the time at which the returned measurement completed is stored there.
+ */
+static int si7021_get_measurement(struct si7021_data *si7021_data,
+				  unsigned long max_age, struct si7021_raw *raw,
+				  ktime_t *timestamp)
+{
+	unsigned int seq = READ_ONCE(si7021_data->meas_seq);
+	ktime_t start;
+	int ret;
+
+	if (mutex_lock_interruptible(&si7021_data->lock))
+		return -ERESTARTSYS;
+
+	if (si7021_data->meas_seq == seq &&
+	    (si7021_data->meas_ret ||
+	     time_after_eq(jiffies, si7021_data->meas_time + max_age))) {
+		si7021_wait_ready(si7021_data);
+		start = ktime_get();
+		si7021_data->meas_ret =
+			si7021_measure(si7021_data, &si7021_data->meas_raw);
+		si7021_data->meas_time = jiffies;
+		si7021_data->meas_timestamp = ktime_get();
+		if (!si7021_data->meas_ret)
+			si7021_update_overhead(
+				si7021_data,
+				ktime_us_delta(si7021_data->meas_timestamp,
+					       start));
+		WRITE_ONCE(si7021_data->meas_seq, seq + 1);
+	}
+
+	ret = si7021_data->meas_ret;
+	*raw = si7021_data->meas_raw;
+	if (timestamp)
+		*timestamp = si7021_data->meas_timestamp;
+	mutex_unlock(&si7021_data->lock);
+
+	return ret;
+}
 
-	result.rl_hum = be16_to_cpu(result.rl_hum);
-	/* The relative humidity value must be in range <0,100> */
-	result.rl_hum = clamp_val(result.rl_hum, 3146, 55574);
-	result.rl_hum = ((unsigned int)result.rl_hum * 125) / 65536 - 6;
+static ssize_t si7021_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *offset)
+{
+	struct si7021_data *si7021_data =
+		(struct si7021_data *)file->private_data;
+	struct si7021_result result;
+	struct si7021_raw raw;
+	int ret;
 
-	if (copy_to_user(buf, &result, min(count, sizeof(result))))
+	ret = si7021_get_measurement(si7021_data, 0, &raw, NULL);
+	if (ret < 0) {
+		trace_si7021_read(iminor(file_inode(file)), 0, 0, ret);
+		return ret;
+	}
+	si7021_raw_to_result(&raw, &result);
+
+	if (copy_to_user(buf, &result, min(count, sizeof(result)))) {
+		trace_si7021_read(iminor(file_inode(file)), result.temp,
+				  result.rl_hum, -EFAULT);
 		return -EFAULT;
+	}
 
+	trace_si7021_read(iminor(file_inode(file)), result.temp, result.rl_hum,
+			  count);
 	return count;
 }
 
@@ -135,28 +303,35 @@ static long si7021_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct si7021_data *si7021_data =
 		(struct si7021_data *)file->private_data;
 	struct i2c_client *client = si7021_data->client;
+	struct si7021_rate rate;
 	u8 reg;
 
+	/* ioctls must not interleave with the two-step measurement xfers */
+	if (mutex_lock_interruptible(&si7021_data->lock))
+		return -ERESTARTSYS;
+	si7021_wait_ready(si7021_data);
+
 	switch (cmd) {
 	case SI7021_IOCTL_RESET:
 		ret = si7021_send_cmd(client, SI7021_CMD_RESET, sizeof(u8));
-		if (ret < 0)
-			return ret;
+		if (ret >= 0) {
+			si7021_set_reset_deadline(si7021_data);
+			si7021_data->res = SI7021_RES_RH12_T14;
+		}
 		break;
 	case SI7021_IOCTL_READ_ID:
-		ret = si7021_cmd_xfer(client, cpu_to_be16(SI7021_CMD_READ_ID_1),
-				      sizeof(u16),
+		ret = si7021_cmd_xfer(client, SI7021_CMD_READ_ID_1, sizeof(u16),
 				      (char *)&read_id.read_id_high,
 				      sizeof(read_id.read_id_high));
 		if (ret < 0)
-			return ret;
+			break;
 		read_id.read_id_high = be32_to_cpu(read_id.read_id_high);
 
-		ret = si7021_cmd_xfer(client, cpu_to_be16(SI7021_CMD_READ_ID_2),
-				      sizeof(u16), (char *)&read_id.read_id_low,
+		ret = si7021_cmd_xfer(client, SI7021_CMD_READ_ID_2, sizeof(u16),
+				      (char *)&read_id.read_id_low,
 				      sizeof(read_id.read_id_low));
 		if (ret < 0)
-			return ret;
+			break;
 		read_id.read_id_low = be32_to_cpu(read_id.read_id_low);
 
 		if (copy_to_user((u64 *)arg, &read_id.read_id,
@@ -166,12 +341,14 @@ static long si7021_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case SI7021_IOCTL_SET_USER_REG:
 		ret = si7021_set_reg_value(client, SI7021_CMD_WRITE_USER_REG,
 					   arg);
+		if (ret >= 0)
+			si7021_data->res = arg & SI7021_USER_REG_RES_MASK;
 		break;
 	case SI7021_IOCTL_GET_USER_REG:
 		ret = si7021_cmd_xfer(client, SI7021_CMD_READ_USER_REG,
 				      sizeof(u8), &reg, sizeof(reg));
 		if (ret < 0)
-			return ret;
+			break;
 
 		if (copy_to_user((char *)arg, &reg, sizeof(reg)))
 			ret = -EFAULT;
@@ -184,75 +361,238 @@ static long si7021_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret = si7021_cmd_xfer(client, SI7021_CMD_READ_HEATER_REG,
 				      sizeof(u8), &reg, sizeof(reg));
 		if (ret < 0)
-			return ret;
+			break;
 
 		if (copy_to_user((char *)arg, &reg, sizeof(reg)))
 			ret = -EFAULT;
 		break;
+	case SI7021_IOCTL_SET_RATE:
+		if (copy_from_user(&rate, (struct si7021_rate *)arg,
+				   sizeof(rate))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = si7021_set_rate(si7021_data, &rate);
+		if (ret < 0)
+			break;
+
+		if (copy_to_user((struct si7021_rate *)arg, &rate,
+				 sizeof(rate)))
+			ret = -EFAULT;
+		break;
 	default:
 		ret = -EINVAL;
 	}
+	mutex_unlock(&si7021_data->lock);
 
 	return ret;
 }
 
-static int si7021_release(struct inode *inode, struct file *file)
-{
-	struct si7021_data *si7021_data = file->private_data;
-
-	clear_bit(SI7021_BUSY_BIT_POS, &si7021_data->flags);
-	return 0;
-}
-
 const struct file_operations si7021_fops = { .owner = THIS_MODULE,
 					     .open = si7021_open,
 					     .read = si7021_read,
 					     .write = si7021_write,
-					     .unlocked_ioctl = si7021_ioctl,
-					     .release = si7021_release };
+					     .unlocked_ioctl = si7021_ioctl };
+
+struct si7021_sweep_job {
+	struct work_struct work;
+	struct si7021_data *si7021_data;
+	struct si7021_record record;
+};
 
-static int get_si7021_minor(void)
+static void si7021_sweep_work(struct work_struct *work)
 {
-	unsigned int i;
+	struct si7021_sweep_job *job =
+		container_of(work, struct si7021_sweep_job, work);
+	struct si7021_raw raw;
+	ktime_t timestamp;
+
+	job->record.id = MINOR(job->si7021_data->cdev.dev);
+	job->record.status = si7021_get_measurement(job->si7021_data, 0, &raw,
+						    &timestamp);
+	if (job->record.status < 0)
+		return;
+
+	job->record.timestamp_ns = ktime_to_ns(timestamp);
+	si7021_raw_to_result(&raw, &job->record.result);
+}
+
+/*
+ * Every read of the "si7021-all" node triggers a measurement on all the
+ * sensors at once. The measurements are queued as separate works on the
+ * unbound workqueue, so the sensors connected to different buses do the
+ * conversions in parallel and the whole sweep costs about one conversion
+ * time. One struct si7021_record is returned for each sensor that fits in
+ * the user's buffer.
+ */
+static ssize_t si7021_all_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *offset)
+{
+	struct si7021_data *si7021_data;
+	struct si7021_sweep_job *jobs;
+	unsigned int i, njobs = 0;
+	ssize_t ret = 0;
+
+	if (count < sizeof(struct si7021_record))
+		return -EINVAL;
+
+	down_read(&si7021_devices_sem);
+
+	list_for_each_entry(si7021_data, &si7021_devices, node)
+		njobs++;
+	njobs = min_t(unsigned int, njobs,
+		      count / sizeof(struct si7021_record));
+	if (!njobs)
+		goto out_unlock;
+
+	jobs = kcalloc(njobs, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	i = 0;
+	list_for_each_entry(si7021_data, &si7021_devices, node) {
+		if (i == njobs)
+			break;
+		jobs[i].si7021_data = si7021_data;
+		INIT_WORK(&jobs[i].work, si7021_sweep_work);
+		queue_work(system_unbound_wq, &jobs[i].work);
+		i++;
+	}
 
-	for (i = 0; i < SI7021_MAX_MINORS; i++)
-		if (si7021_minors[i] == 0)
-			return i;
+	for (i = 0; i < njobs; i++)
+		flush_work(&jobs[i].work);
 
-	return -1;
+	for (i = 0; i < njobs; i++) {
+		if (copy_to_user(buf + ret, &jobs[i].record,
+				 sizeof(jobs[i].record))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret += sizeof(jobs[i].record);
+	}
+
+	kfree(jobs);
+out_unlock:
+	up_read(&si7021_devices_sem);
+	return ret;
+}
+
+const struct file_operations si7021_all_fops = { .owner = THIS_MODULE,
+						 .read = si7021_all_read };
+
+static umode_t si7021_hwmon_is_visible(const void *data,
+				       enum hwmon_sensor_types type, u32 attr,
+				       int channel)
+{
+	switch (type) {
+	case hwmon_chip:
+		return attr == hwmon_chip_update_interval ? 0644 : 0;
+	case hwmon_temp:
+	case hwmon_humidity:
+		return 0444;
+	default:
+		return 0;
+	}
 }
 
+static int si7021_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+			     u32 attr, int channel, long *val)
+{
+	struct si7021_data *si7021_data = dev_get_drvdata(dev);
+	unsigned int update_interval = READ_ONCE(si7021_data->update_interval);
+	struct si7021_raw raw;
+	int ret;
+
+	if (type == hwmon_chip) {
+		*val = update_interval;
+		return 0;
+	}
+
+	ret = si7021_get_measurement(
+		si7021_data, msecs_to_jiffies(update_interval), &raw, NULL);
+	if (ret < 0)
+		return ret;
+
+	if (type == hwmon_temp)
+		*val = si7021_raw_to_temp_mc(&raw);
+	else
+		*val = si7021_raw_to_hum_mpct(&raw);
+
+	return 0;
+}
+
+static int si7021_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+			      u32 attr, int channel, long val)
+{
+	struct si7021_data *si7021_data = dev_get_drvdata(dev);
+
+	if (type != hwmon_chip || attr != hwmon_chip_update_interval)
+		return -EOPNOTSUPP;
+
+	WRITE_ONCE(si7021_data->update_interval,
+		   clamp_val(val, 0, SI7021_MAX_UPDATE_INTERVAL));
+	return 0;
+}
+
+static const struct hwmon_ops si7021_hwmon_ops = {
+	.is_visible = si7021_hwmon_is_visible,
+	.read = si7021_hwmon_read,
+	.write = si7021_hwmon_write,
+};
+
+static const struct hwmon_channel_info *si7021_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(chip, HWMON_C_UPDATE_INTERVAL),
+	HWMON_CHANNEL_INFO(temp, HWMON_T_INPUT),
+	HWMON_CHANNEL_INFO(humidity, HWMON_H_INPUT),
+	NULL
+};
+
+static const struct hwmon_chip_info si7021_hwmon_chip_info = {
+	.ops = &si7021_hwmon_ops,
+	.info = si7021_hwmon_info,
+};
+
 static int si7021_probe(struct i2c_client *client,
 			const struct i2c_device_id *id)
 {
 	long ret;
 	struct si7021_data *data;
-	unsigned int minor;
-
-	minor = get_si7021_minor();
-	if (minor == -1) {
-		ret = -EIO;
-		dev_err_probe(&client->dev, ret,
-			      "reached max number of devices\n");
-		return ret;
-	}
-	si7021_minors[minor] = 1;
+	struct device *hwmon_dev;
+	int minor;
 
 	data = devm_kzalloc(&client->dev, sizeof(struct si7021_data),
 			    GFP_KERNEL);
-	if (!data) {
-		ret = -ENOMEM;
-		dev_err_probe(&client->dev, ret,
-			      "unable to allocate driver data\n");
-		goto err_min_ret;
-	}
+	if (!data)
+		return dev_err_probe(&client->dev, -ENOMEM,
+				     "unable to allocate driver data\n");
+
+	minor = dev_registry_add(&si7021_registry, data);
+	if (minor < 0)
+		return dev_err_probe(&client->dev, minor,
+				     "reached max number of devices\n");
+
+	data->client = client;
+	mutex_init(&data->lock);
 
-	/* reset the device and wait 15ms which is the powerup time 
-    after issuing a software reset command */
+	/* reset the device - instead of sleeping until it powers up, just
+	 * record the deadline, so the first access waits only if needed */
 	ret = si7021_send_cmd(client, SI7021_CMD_RESET, sizeof(u8));
 	if (ret < 0)
 		goto err_min_ret;
-	msleep(15);
+	si7021_set_reset_deadline(data);
+	data->meas_ret = -ENODATA;
+	data->update_interval = SI7021_DEFAULT_UPDATE_INTERVAL;
+
+	hwmon_dev = devm_hwmon_device_register_with_info(
+		&client->dev, "si7021", data, &si7021_hwmon_chip_info, NULL);
+	if (IS_ERR(hwmon_dev)) {
+		ret = PTR_ERR(hwmon_dev);
+		dev_err_probe(&client->dev, ret, "cannot register hwmon\n");
+		goto err_min_ret;
+	}
 
 	cdev_init(&data->cdev, &si7021_fops);
 	ret = cdev_add(&data->cdev, MKDEV(si7021_major, minor), 1);
@@ -261,8 +601,6 @@ static int si7021_probe(struct i2c_client *client,
 		goto err_min_ret;
 	}
 
-	data->client = client;
-
 	i2c_set_clientdata(client, data);
 
 	ret = IS_ERR(device_create(si7021_class, &client->dev,
@@ -271,12 +609,16 @@ static int si7021_probe(struct i2c_client *client,
 	if (IS_ERR((void *)ret))
 		dev_err_probe(&client->dev, ret, "cannot create char device\n");
 
+	down_write(&si7021_devices_sem);
+	list_add_tail(&data->node, &si7021_devices);
+	up_write(&si7021_devices_sem);
+
 	dev_info(&client->dev, "successful probe of device: %s\n",
 		 client->name);
 	return 0;
 
 err_min_ret:
-	si7021_minors[minor] = 0;
+	dev_registry_remove(&si7021_registry, minor);
 	return ret;
 }
 
@@ -288,10 +630,13 @@ static int si7021_remove(struct i2c_client *client)
 	data = i2c_get_clientdata(client);
 	minor = MINOR(data->cdev.dev);
 
-	cdev_del(&data->cdev);
-	si7021_minors[minor] = 0;
+	down_write(&si7021_devices_sem);
+	list_del(&data->node);
+	up_write(&si7021_devices_sem);
 
+	cdev_del(&data->cdev);
 	device_destroy(si7021_class, MKDEV(si7021_major, minor));
+	dev_registry_remove(&si7021_registry, minor);
 
 	return 0;
 }
@@ -305,6 +650,7 @@ static struct i2c_driver si7021_driver = {
 	.driver = {
 		.name = "si7021",
 		.of_match_table = si7021_dt_ids,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = si7021_probe,
 	.remove = si7021_remove,
@@ -315,7 +661,8 @@ static int __init si7021_init(void)
 	int ret;
 	dev_t dev;
 
-	ret = alloc_chrdev_region(&dev, 0, SI7021_MAX_MINORS, "si7021_driver");
+	ret = alloc_chrdev_region(&dev, 0, SI7021_MAX_MINORS + 1,
+				  "si7021_driver");
 	if (ret != 0) {
 		printk(KERN_ERR
 		       "si7021_driver: cannot allocate chrdev region\n");
@@ -329,20 +676,36 @@ static int __init si7021_init(void)
 		goto err_unreg;
 	}
 
+	cdev_init(&si7021_all_cdev, &si7021_all_fops);
+	ret = cdev_add(&si7021_all_cdev, MKDEV(si7021_major, SI7021_ALL_MINOR),
+		       1);
+	if (ret) {
+		printk(KERN_ERR "si7021_driver: cdev_add failed\n");
+		goto err_cls;
+	}
+
+	if (IS_ERR(device_create(si7021_class, NULL,
+				 MKDEV(si7021_major, SI7021_ALL_MINOR), NULL,
+				 "si7021-all")))
+		printk(KERN_ERR "si7021_driver: cannot create char device\n");
+
 	ret = i2c_add_driver(&si7021_driver);
 	if (ret) {
 		printk(KERN_ERR
 		       "si7021_driver: error while registering the driver\n");
-		goto err_cls;
+		goto err_all_del;
 	}
 
 	printk(KERN_INFO "si7021_driver: successfully registered\n");
 	return 0;
 
+err_all_del:
+	device_destroy(si7021_class, MKDEV(si7021_major, SI7021_ALL_MINOR));
+	cdev_del(&si7021_all_cdev);
 err_cls:
 	class_destroy(si7021_class);
 err_unreg:
-	unregister_chrdev_region(si7021_major, SI7021_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(si7021_major, 0), SI7021_MAX_MINORS + 1);
 	return ret;
 }
 
@@ -350,9 +713,12 @@ static void __exit si7021_cleanup(void)
 {
 	printk(KERN_INFO "si7021_driver removal\n");
 
-	unregister_chrdev_region(si7021_major, SI7021_MAX_MINORS);
+	unregister_chrdev_region(MKDEV(si7021_major, 0), SI7021_MAX_MINORS + 1);
 	i2c_del_driver(&si7021_driver);
+	device_destroy(si7021_class, MKDEV(si7021_major, SI7021_ALL_MINOR));
+	cdev_del(&si7021_all_cdev);
 	class_destroy(si7021_class);
+	dev_registry_destroy(&si7021_registry);
 }
 
 module_init(si7021_init);
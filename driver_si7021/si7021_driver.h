@@ -7,14 +7,42 @@
 #define SI7021_IOCTL_GET_USER_REG _IOR('S', 3, char)
 #define SI7021_IOCTL_SET_HEATER_REG _IOW('S', 4, char)
 #define SI7021_IOCTL_GET_HEATER_REG _IOR('S', 5, char)
+#define SI7021_IOCTL_SET_RATE _IOWR('S', 6, struct si7021_rate)
 
 struct si7021_result {
 	short temp;
 	unsigned short rl_hum;
 };
 
+/* A single entry of the array returned by a read of /dev/si7021-all */
+struct si7021_record {
+	unsigned int id; /* N of the /dev/si7021-N device */
+	int status; /* 0 or a negative error code of the measurement */
+	long long timestamp_ns; /* CLOCK_MONOTONIC completion time */
+	struct si7021_result result;
+};
+
+/*
+ * SI7021_IOCTL_SET_RATE argument: the driver selects the finest resolution
+ * whose conversion time (plus the measured I2C overhead) still allows to
+ * sample at `rate_mhz`, programs it into the user register and reports back
+ * the selected resolution and the sample rate that it is able to sustain.
+ */
+struct si7021_rate {
+	unsigned int rate_mhz; /* requested sample rate in mHz */
+	unsigned int eff_rate_mhz; /* effective sample rate in mHz */
+	unsigned char res; /* selected SI7021_RES_* value */
+};
+
 #define SI7021_USER_REG_BIT_HEATER 2
 
+/* Measurement resolution - bits RES1 (D7) and RES0 (D0) of the user reg */
+#define SI7021_USER_REG_RES_MASK 0x81
+#define SI7021_RES_RH12_T14 0x00
+#define SI7021_RES_RH8_T12 0x01
+#define SI7021_RES_RH10_T13 0x80
+#define SI7021_RES_RH11_T11 0x81
+
 #define SI7021_HEATER_ON(user_reg) \
 	(user_reg |= (1 << SI7021_USER_REG_BIT_HEATER))
 #define SI7021_HEATER_OFF(user_reg) \
@@ -0,0 +1,192 @@
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include "si7021_conv.h"
+
+/* number of calls timed by the *_cost test cases */
+#define SI7021_KUNIT_ITERS 100000
+
+static void si7021_kunit_temp_limits(struct kunit *test)
+{
+	struct si7021_raw raw = { 0 };
+	struct si7021_result result;
+
+	si7021_raw_to_result(&raw, &result);
+	KUNIT_EXPECT_EQ(test, (int)result.temp, -46);
+	KUNIT_EXPECT_EQ(test, si7021_raw_to_temp_mc(&raw), -46850L);
+
+	raw.temp = 0xFFFF;
+	si7021_raw_to_result(&raw, &result);
+	KUNIT_EXPECT_EQ(test, (int)result.temp, 128);
+	KUNIT_EXPECT_EQ(test, si7021_raw_to_temp_mc(&raw), 128867L);
+
+	/* 25 degrees Celsius */
+	raw.temp = 26797;
+	si7021_raw_to_result(&raw, &result);
+	KUNIT_EXPECT_EQ(test, (int)result.temp, 25);
+	KUNIT_EXPECT_EQ(test, si7021_raw_to_temp_mc(&raw), 25000L);
+}
+
+static void si7021_kunit_hum_clamp(struct kunit *test)
+{
+	/* codes outside of <3146,55575> would give RH outside of <0,100> */
+	static const struct {
+		unsigned short rl_hum;
+		unsigned short pct;
+		long mpct;
+	} cases[] = {
+		{ 0, 0, 0 },
+		{ 3145, 0, 0 },
+		{ 3146, 0, 0 },
+		{ 32768, 56, 56500 },
+		{ 55574, 99, 99998 },
+		{ 55575, 100, 100000 },
+		{ 0xFFFF, 100, 100000 },
+	};
+	struct si7021_raw raw = { 0 };
+	struct si7021_result result;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		raw.rl_hum = cases[i].rl_hum;
+		si7021_raw_to_result(&raw, &result);
+		KUNIT_EXPECT_EQ_MSG(test, result.rl_hum, cases[i].pct,
+				    "raw RH code %u", cases[i].rl_hum);
+		KUNIT_EXPECT_EQ_MSG(test, si7021_raw_to_hum_mpct(&raw),
+				    cases[i].mpct, "raw RH code %u",
+				    cases[i].rl_hum);
+	}
+}
+
+/*
+ * The character devices return whole units, hwmon returns milli-units - both
+ * have to agree for every code the device can return.
+ */
+static void si7021_kunit_units_agree(struct kunit *test)
+{
+	struct si7021_result result;
+	struct si7021_raw raw;
+	unsigned int code;
+	long milli, diff;
+
+	for (code = 0; code <= 0xFFFF; code++) {
+		raw.temp = code;
+		raw.rl_hum = code;
+		si7021_raw_to_result(&raw, &result);
+
+		milli = si7021_raw_to_temp_mc(&raw);
+		diff = milli - result.temp * 1000L;
+		KUNIT_ASSERT_TRUE_MSG(test, diff > -1000 && diff < 1000,
+				      "temp code %u: %d C vs %ld mC", code,
+				      result.temp, milli);
+
+		milli = si7021_raw_to_hum_mpct(&raw);
+		diff = milli - result.rl_hum * 1000L;
+		KUNIT_ASSERT_TRUE_MSG(test, diff >= 0 && diff < 1000,
+				      "RH code %u: %u%% vs %ld m%%", code,
+				      result.rl_hum, milli);
+	}
+}
+
+static void si7021_kunit_conv_time(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, si7021_conv_time_us(SI7021_RES_RH12_T14), 22800U);
+	KUNIT_EXPECT_EQ(test, si7021_conv_time_us(SI7021_RES_RH10_T13), 10700U);
+	KUNIT_EXPECT_EQ(test, si7021_conv_time_us(SI7021_RES_RH11_T11), 9400U);
+	KUNIT_EXPECT_EQ(test, si7021_conv_time_us(SI7021_RES_RH8_T12), 6900U);
+
+	/* an unknown setting is treated as the slowest one */
+	KUNIT_EXPECT_EQ(test, si7021_conv_time_us(0x7E), 22800U);
+}
+
+static void si7021_kunit_res_for_period(struct kunit *test)
+{
+	unsigned int last = ARRAY_SIZE(si7021_res_timings) - 1;
+
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(1000000, 0), 0U);
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(22800, 0), 0U);
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(22799, 0), 1U);
+	/* the I2C overhead moves the choice to a coarser resolution */
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(22800, 1), 1U);
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(9400, 0), 2U);
+
+	/* too short periods get the coarsest resolution anyway */
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(6900, 0), last);
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(0, 0), last);
+	KUNIT_EXPECT_EQ(test, si7021_res_for_period(1000000, 1000000), last);
+}
+
+/* The conversions run on every read, so their per-call cost is reported */
+static void si7021_kunit_conv_cost(struct kunit *test)
+{
+	struct si7021_result result;
+	struct si7021_raw raw;
+	long milli = 0;
+	ktime_t start;
+	s64 result_ns, milli_ns;
+	unsigned int i;
+
+	start = ktime_get();
+	for (i = 0; i < SI7021_KUNIT_ITERS; i++) {
+		raw.temp = i;
+		raw.rl_hum = i;
+		si7021_raw_to_result(&raw, &result);
+		barrier_data(&result);
+	}
+	result_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < SI7021_KUNIT_ITERS; i++) {
+		raw.temp = i;
+		raw.rl_hum = i;
+		milli += si7021_raw_to_temp_mc(&raw);
+		milli += si7021_raw_to_hum_mpct(&raw);
+		barrier_data(&milli);
+	}
+	milli_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	kunit_info(test, "si7021_raw_to_result: %lld ns/call\n",
+		   div_s64(result_ns, SI7021_KUNIT_ITERS));
+	kunit_info(test, "si7021_raw_to_{temp_mc,hum_mpct}: %lld ns/call\n",
+		   div_s64(milli_ns, SI7021_KUNIT_ITERS));
+}
+
+static void si7021_kunit_res_for_period_cost(struct kunit *test)
+{
+	unsigned int i, res = 0;
+	ktime_t start;
+	s64 elapsed_ns;
+
+	start = ktime_get();
+	for (i = 0; i < SI7021_KUNIT_ITERS; i++) {
+		res += si7021_res_for_period(i, i & 0xFFF);
+		barrier_data(&res);
+	}
+	elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	kunit_info(test, "si7021_res_for_period: %lld ns/call\n",
+		   div_s64(elapsed_ns, SI7021_KUNIT_ITERS));
+}
+
+static struct kunit_case si7021_kunit_cases[] = {
+	KUNIT_CASE(si7021_kunit_temp_limits),
+	KUNIT_CASE(si7021_kunit_hum_clamp),
+	KUNIT_CASE(si7021_kunit_units_agree),
+	KUNIT_CASE(si7021_kunit_conv_time),
+	KUNIT_CASE(si7021_kunit_res_for_period),
+	KUNIT_CASE(si7021_kunit_conv_cost),
+	KUNIT_CASE(si7021_kunit_res_for_period_cost),
+	{}
+};
+
+static struct kunit_suite si7021_kunit_suite = {
+	.name = "si7021",
+	.test_cases = si7021_kunit_cases,
+};
+
+kunit_test_suites(&si7021_kunit_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Antoni Pokusinski");
+MODULE_DESCRIPTION("KUnit tests of the si7021 driver");
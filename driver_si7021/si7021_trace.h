@@ -0,0 +1,82 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM si7021
+
+#if !defined(_SI7021_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SI7021_TRACE_H
+
+#include <linux/i2c.h>
+#include <linux/tracepoint.h>
+
+/* clang-format off */
+DECLARE_EVENT_CLASS(si7021_xfer,
+	TP_PROTO(const struct i2c_client *client, u16 cmd,
+		 unsigned int cmd_size, unsigned int rx_size, int ret),
+	TP_ARGS(client, cmd, cmd_size, rx_size, ret),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(u16, cmd)
+		__field(unsigned int, cmd_size)
+		__field(unsigned int, rx_size)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->bus = i2c_adapter_id(client->adapter);
+		__entry->addr = client->addr;
+		__entry->cmd = cmd;
+		__entry->cmd_size = cmd_size;
+		__entry->rx_size = rx_size;
+		__entry->ret = ret;
+	),
+
+	TP_printk("i2c-%d addr=0x%02x cmd=0x%04x cmd_size=%u rx_size=%u ret=%d",
+		  __entry->bus, __entry->addr, __entry->cmd, __entry->cmd_size,
+		  __entry->rx_size, __entry->ret)
+);
+
+/* the pair of events brackets the transfer, so it gives the I2C latency */
+DEFINE_EVENT(si7021_xfer, si7021_cmd_xfer_start,
+	TP_PROTO(const struct i2c_client *client, u16 cmd,
+		 unsigned int cmd_size, unsigned int rx_size, int ret),
+	TP_ARGS(client, cmd, cmd_size, rx_size, ret)
+);
+
+DEFINE_EVENT(si7021_xfer, si7021_cmd_xfer,
+	TP_PROTO(const struct i2c_client *client, u16 cmd,
+		 unsigned int cmd_size, unsigned int rx_size, int ret),
+	TP_ARGS(client, cmd, cmd_size, rx_size, ret)
+);
+
+TRACE_EVENT(si7021_read,
+	TP_PROTO(unsigned int minor, int temp, int rl_hum, ssize_t ret),
+	TP_ARGS(minor, temp, rl_hum, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(int, temp)
+		__field(int, rl_hum)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->temp = temp;
+		__entry->rl_hum = rl_hum;
+		__entry->ret = ret;
+	),
+
+	TP_printk("si7021-%u temp=%d rl_hum=%d ret=%zd", __entry->minor,
+		  __entry->temp, __entry->rl_hum, __entry->ret)
+);
+/* clang-format on */
+
+#endif /* _SI7021_TRACE_H */
+
+/* found through the -I$(src) that Kbuild adds for si7021_driver.o */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE si7021_trace
+#include <trace/define_trace.h>
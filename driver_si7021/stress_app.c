@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <stdlib.h>
+
+#include "si7021_driver.h"
+#include "stress.h"
+
+#define MAX_DEVICES 8
+#define USER_REG_DEFAULT 0x3A
+
+static const char *devices[MAX_DEVICES];
+static unsigned int ndevices;
+/* serial numbers read before the stress, which must never change */
+static long long ids[MAX_DEVICES];
+
+static int si7021_stress_init(struct stress_thread *thread)
+{
+	/* the device can be opened by all the threads at once */
+	thread->fd = open(devices[thread->id % ndevices], O_RDWR);
+	return thread->fd < 0;
+}
+
+/*
+ * Every thread keeps its own descriptor and issues a random mix of reads and
+ * ioctls, whose results are checked against the state of the device, which is
+ * not changed during the stress.
+ */
+static int si7021_stress_iter(struct stress_thread *thread)
+{
+	struct si7021_result result;
+	long long id;
+	char user_reg;
+
+	switch (rand_r(&thread->seed) % 3) {
+	case 0:
+		if (read(thread->fd, &result, sizeof(result)) != sizeof(result))
+			return STRESS_LOST;
+		if (result.temp < -40 || result.temp > 125 ||
+		    result.rl_hum > 100)
+			return STRESS_LOST;
+		break;
+	case 1:
+		if (ioctl(thread->fd, SI7021_IOCTL_READ_ID, &id) < 0 ||
+		    id != ids[thread->id % ndevices])
+			return STRESS_LOST;
+		break;
+	default:
+		if (ioctl(thread->fd, SI7021_IOCTL_GET_USER_REG, &user_reg) < 0)
+			return STRESS_LOST;
+		if (user_reg != USER_REG_DEFAULT)
+			return STRESS_LOST;
+		break;
+	}
+
+	return STRESS_OK;
+}
+
+static void si7021_stress_fini(struct stress_thread *thread)
+{
+	close(thread->fd);
+}
+
+static const struct stress_ops si7021_stress_ops = {
+	.name = "si7021",
+	.init = si7021_stress_init,
+	.iter = si7021_stress_iter,
+	.fini = si7021_stress_fini,
+};
+
+int main(int argc, const char *argv[])
+{
+	unsigned int duration_s;
+	int i, fd;
+
+	if (argc < 2 || argc > MAX_DEVICES + 2) {
+		fprintf(stderr,
+			"usage: %s <duration_s> [char_dev_file...]\n"
+			"e.g. %s 5 /dev/si7021-0 /dev/si7021-1\n",
+			argv[0], argv[0]);
+		exit(1);
+	}
+	duration_s = strtoul(argv[1], NULL, 0);
+
+	for (i = 2; i < argc; i++)
+		devices[ndevices++] = argv[i];
+	if (!ndevices)
+		devices[ndevices++] = "/dev/si7021-0";
+
+	for (i = 0; i < ndevices; i++) {
+		fd = open(devices[i], O_RDWR);
+		if (fd < 0 || ioctl(fd, SI7021_IOCTL_READ_ID, &ids[i]) < 0) {
+			fprintf(stderr, "si7021: cannot read id of %s\n",
+				devices[i]);
+			exit(1);
+		}
+		close(fd);
+	}
+
+	return stress_run(&si7021_stress_ops, duration_s) ? 1 : 0;
+}
@@ -5,6 +5,7 @@
 #include <sys/ioctl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include "si7021_driver.h"
 
 static int is_chardev(const char *filename)
@@ -36,6 +37,66 @@ static void test_read(int fd)
 	printf("rl_humidity: %d\n", result.rl_hum);
 }
 
+/* The device can be opened by many processes, which read it concurrently */
+static void test_shared_read(const char *filename)
+{
+	int fd1, fd2, status;
+	struct si7021_result result;
+	pid_t pid;
+
+	printf("%s running...\n", __func__);
+
+	fd1 = open(filename, O_RDONLY);
+	assert(fd1 > 0);
+	fd2 = open(filename, O_RDONLY);
+	assert(fd2 > 0);
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		get_measurement(fd1, &result);
+		exit(result.rl_hum > 100);
+	}
+	get_measurement(fd2, &result);
+	assert(result.rl_hum <= 100);
+
+	waitpid(pid, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	close(fd2);
+	close(fd1);
+
+	printf("%s succeeded!\n", __func__);
+}
+
+/* Sample all the sensors at once through the aggregate node */
+static void test_read_all(void)
+{
+	struct si7021_record records[8];
+	ssize_t size;
+	int fd, i;
+
+	printf("%s running...\n", __func__);
+
+	fd = open("/dev/si7021-all", O_RDONLY);
+	assert(fd > 0);
+
+	size = read(fd, records, sizeof(records));
+	assert(size > 0 && size % sizeof(records[0]) == 0);
+
+	for (i = 0; i < size / sizeof(records[0]); i++) {
+		assert(records[i].status == 0);
+		assert(records[i].result.rl_hum <= 100);
+		printf("si7021-%u @ %lld ns: temp: %d, rl_hum: %d\n",
+		       records[i].id, records[i].timestamp_ns,
+		       records[i].result.temp, records[i].result.rl_hum);
+	}
+
+	close(fd);
+
+	printf("%s succeeded!\n", __func__);
+}
+
 static void get_user_reg(int fd, char *user_reg)
 {
 	if (ioctl(fd, SI7021_IOCTL_GET_USER_REG, user_reg) < 0) {
@@ -92,6 +153,45 @@ static void test_user_reg(int fd)
 	printf("%s succeeded!\n", __func__);
 }
 
+static void set_rate(int fd, struct si7021_rate *rate)
+{
+	if (ioctl(fd, SI7021_IOCTL_SET_RATE, rate) < 0) {
+		fprintf(stderr, "si7021: set_rate ioctl error\n");
+		exit(1);
+	}
+}
+
+static void test_rate(int fd)
+{
+	struct si7021_rate rate = { 0 };
+	char user_reg = 0;
+
+	printf("%s running...\n", __func__);
+
+	/* A slow rate can be met with the finest resolution */
+	rate.rate_mhz = 1000;
+	set_rate(fd, &rate);
+	assert(rate.res == SI7021_RES_RH12_T14);
+	assert(rate.eff_rate_mhz >= rate.rate_mhz);
+
+	/* No resolution is fast enough for 1kHz - the coarsest one is used */
+	rate.rate_mhz = 1000000;
+	set_rate(fd, &rate);
+	assert(rate.res == SI7021_RES_RH8_T12);
+	printf("effective rate: %u mHz\n", rate.eff_rate_mhz);
+
+	get_user_reg(fd, &user_reg);
+	assert((user_reg & SI7021_USER_REG_RES_MASK) == SI7021_RES_RH8_T12);
+	test_read(fd);
+
+	rate.rate_mhz = 1000;
+	set_rate(fd, &rate);
+	get_user_reg(fd, &user_reg);
+	assert(user_reg == 0x3A);
+
+	printf("%s succeeded!\n", __func__);
+}
+
 static void test_heater_reg(int fd)
 {
 	char user_reg = 0;
@@ -157,7 +257,10 @@ int main(int argc, const char *argv[])
 	printf("serial id: 0x%llx\n", serial_id);
 
 	test_read(fd);
+	test_shared_read(argv[1]);
+	test_read_all();
 	test_user_reg(fd);
+	test_rate(fd);
 	test_heater_reg(fd);
 
 	close(fd);
@@ -1,14 +1,1246 @@
 #include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/of.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/events.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include "si7210_driver.h"
+
+#define SI7210_REG_HREVID 0xC0
+#define SI7210_REG_DSPSIGM 0xC1
+#define SI7210_REG_DSPSIGL 0xC2
+#define SI7210_REG_DSPSIGSEL 0xC3
+#define SI7210_REG_POWER_CTRL 0xC4
+#define SI7210_REG_ARAUTOINC 0xC5
+#define SI7210_REG_SW_OP 0xC6
+#define SI7210_REG_SW_HYST 0xC7
+#define SI7210_REG_SLTIME 0xC8
+#define SI7210_REG_SLTIMEENA 0xC9
+#define SI7210_REG_A0 0xCA
+#define SI7210_REG_A1 0xCB
+#define SI7210_REG_A2 0xCC
+#define SI7210_REG_DF 0xCD
+#define SI7210_REG_A3 0xCE
+#define SI7210_REG_A4 0xCF
+#define SI7210_REG_A5 0xD0
+#define SI7210_REG_OTP_ADDR 0xE1
+#define SI7210_REG_OTP_DATA 0xE2
+#define SI7210_REG_OTP_CTRL 0xE3
+
+#define SI7210_CHIP_ID 0x1
+#define SI7210_HREVID_CHIP_ID(reg) ((reg) >> 4)
+
+#define SI7210_DSPSIGM_MASK 0x7F
+
+#define SI7210_DSPSIGSEL_FIELD 0
+#define SI7210_DSPSIGSEL_TEMP 1
+
+#define SI7210_POWER_CTRL_SLEEP (1 << 0)
+#define SI7210_POWER_CTRL_STOP (1 << 1)
+#define SI7210_POWER_CTRL_ONEBURST (1 << 2)
+#define SI7210_POWER_CTRL_USESTORE (1 << 3)
+#define SI7210_POWER_CTRL_MEAS (1 << 7)
+
+#define SI7210_ARAUTOINC_EN (1 << 0)
+
+#define SI7210_OTP_CTRL_READ_EN (1 << 1)
+
+/* OTP addresses of the calibration data */
+#define SI7210_OTP_TEMP_OFFSET 0x1D
+#define SI7210_OTP_TEMP_GAIN 0x1E
+#define SI7210_OTP_A0_20MT 0x21
+
+#define SI7210_SW_OP_LOW4FIELD (1 << 7)
+#define SI7210_SW_OP_ZERO 0x7F
+#define SI7210_SW_HYST_ZERO 0x3F
+#define SI7210_SW_FIELDPOLSEL_SHIFT 6
+#define SI7210_FIELDPOLSEL_OMNI 0
+#define SI7210_FIELDPOLSEL_POS 2
+#define SI7210_FIELDPOLSEL_NEG 3
+
+#define SI7210_SLTIMEENA_EN (1 << 0)
+#define SI7210_SW_TAMPER_OFF (0x3F << 2)
+
+#define SI7210_DF_BURSTSIZE_SHIFT 5
+#define SI7210_DF_BURSTSIZE_MAX 7
+#define SI7210_DF_BW_SHIFT 1
+/* up to 4096 samples can be averaged */
+#define SI7210_DF_BW_MAX 12
+
+/*
+ * The comparator threshold and hysteresis and the sleep timer period are
+ * encoded as (base + m) << e. The threshold is in units of 5uT and the
+ * hysteresis in units of 2.5uT, that is 4 and 2 field codes in the 20mT
+ * range. The sleep timer runs from a ~11kHz clock.
+ */
+#define SI7210_SW_OP_UNIT 4
+#define SI7210_SW_HYST_UNIT 2
+#define SI7210_SW_OP_BASE 16
+#define SI7210_SW_OP_MBITS 4
+#define SI7210_SW_HYST_BASE 8
+#define SI7210_SW_HYST_MBITS 3
+#define SI7210_SLTIME_BASE 32
+#define SI7210_SLTIME_MBITS 5
+#define SI7210_SLTIME_TICK_NS 90909ULL
+#define SI7210_EXP_MAX 7
+/*
+ * Sleep timer period used if only the comparator needs the autonomous mode:
+ * 0x37 is (32 + 23) << 1 = 110 ticks, ~10ms
+ */
+#define SI7210_DEFAULT_SLTIME 0x37
+
+/* DSPSIG value that corresponds to 0 mT */
+#define SI7210_FIELD_ZERO 16384
+/* field code in the 20mT range: 0.00125 mT */
+#define SI7210_FIELD_CODE_NT 1250
+/* a single conversion takes a few us, so only a couple of polls are needed */
+#define SI7210_MEAS_POLL_US 10
+#define SI7210_MEAS_TRIES 20
+
+enum si7210_scan { SI7210_SCAN_FIELD, SI7210_SCAN_TEMP, SI7210_SCAN_TS };
+
+/* registers of the field temperature compensation coefficients A0..A5 */
+static const u8 si7210_a_regs[] = { SI7210_REG_A0, SI7210_REG_A1,
+				    SI7210_REG_A2, SI7210_REG_A3,
+				    SI7210_REG_A4, SI7210_REG_A5 };
+
+/*
+ * Calibration data read from the OTP memory once at probe. The temperature
+ * correction is kept in a form ready for the fixed-point math done on every
+ * sample: T' = (T * temp_gain) >> 11 + temp_offset
+ */
+struct si7210_calib {
+	int temp_gain; /* 2048 + OTP gain, in 1/2048 units */
+	int temp_offset; /* OTP offset, converted to millidegrees Celsius */
+	u8 a[ARRAY_SIZE(si7210_a_regs)];
+};
+
+static int si7210_major;
+static struct class *si7210_class;
+static struct cdev si7210_all_cdev;
+
+/* all the probed sensors, swept by reads of the "si7210-all" node */
+static LIST_HEAD(si7210_devices);
+static DECLARE_RWSEM(si7210_devices_sem);
+
+struct si7210_data {
+	struct i2c_client *client;
+	struct list_head node;
+	struct si7210_calib calib;
+	/* serializes the measurement sequences sent to the device */
+	struct mutex lock;
+	/* comparator configuration, exposed as IIO events */
+	bool ev_enabled;
+	enum iio_event_type ev_type;
+	int ev_thresh;
+	unsigned int ev_hyst;
+	/* set once the field went past the threshold, inverts the output pin */
+	bool ev_low4field;
+	/* autonomous sampling requested through sampling_frequency */
+	bool samp_enabled;
+	u8 sltime;
+	/* log2 of the number of averaged samples */
+	unsigned int osr_log2;
+	/* buffer for the triggered capture: active channels + timestamp */
+	struct {
+		s32 chan[2];
+		s64 timestamp __aligned(8);
+	} scan;
+};
+
+static int si7210_read_reg(struct i2c_client *client, u8 reg, u8 *val)
+{
+	int ret = i2c_smbus_read_byte_data(client, reg);
+	if (ret < 0) {
+		dev_err(&client->dev, "failed to read si7210 reg 0x%x\n", reg);
+		return ret;
+	}
+	*val = ret;
+	return 0;
+}
+
+static int si7210_write_reg(struct i2c_client *client, u8 reg, u8 val)
+{
+	int ret = i2c_smbus_write_byte_data(client, reg, val);
+	if (ret < 0)
+		dev_err(&client->dev, "failed to write si7210 reg 0x%x\n", reg);
+	return ret;
+}
+
+static int si7210_wait_meas(struct i2c_client *client)
+{
+	unsigned int tries = SI7210_MEAS_TRIES;
+	u8 power_ctrl;
+	int ret;
+
+	do {
+		ret = si7210_read_reg(client, SI7210_REG_POWER_CTRL,
+				      &power_ctrl);
+		if (ret < 0)
+			return ret;
+		if (!(power_ctrl & SI7210_POWER_CTRL_MEAS))
+			return 0;
+		usleep_range(SI7210_MEAS_POLL_US, 2 * SI7210_MEAS_POLL_US);
+	} while (--tries);
+
+	return -ETIMEDOUT;
+}
+
+/* Fetch the 15-bit code of the last conversion */
+static int si7210_fetch(struct si7210_data *data, u16 *dspsig)
+{
+	u8 buf[2];
+	int ret;
+
+	/* DSPSIGM and DSPSIGL are read in one go thanks to ARAUTOINC */
+	ret = i2c_smbus_read_i2c_block_data(data->client, SI7210_REG_DSPSIGM,
+					    sizeof(buf), buf);
+	if (ret < 0)
+		return ret;
+	if (ret != sizeof(buf))
+		return -EIO;
+
+	*dspsig = ((buf[0] & SI7210_DSPSIGM_MASK) << 8) | buf[1];
+	return 0;
+}
+
+/* Start a single conversion of `dspsigsel` signal */
+static int si7210_start_conversion(struct si7210_data *data, u8 dspsigsel)
+{
+	struct i2c_client *client = data->client;
+	int ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_DSPSIGSEL, dspsigsel);
+	if (ret < 0)
+		return ret;
+
+	return si7210_write_reg(client, SI7210_REG_POWER_CTRL,
+				SI7210_POWER_CTRL_USESTORE |
+					SI7210_POWER_CTRL_ONEBURST);
+}
+
+/* Wait for the started conversion and fetch its 15-bit code */
+static int si7210_finish_conversion(struct si7210_data *data, u16 *dspsig)
+{
+	int ret;
+
+	ret = si7210_wait_meas(data->client);
+	if (ret < 0)
+		return ret;
+
+	return si7210_fetch(data, dspsig);
+}
+
+static int si7210_measure(struct si7210_data *data, u8 dspsigsel, u16 *dspsig)
+{
+	int ret;
+
+	ret = si7210_start_conversion(data, dspsigsel);
+	if (ret < 0)
+		return ret;
+
+	return si7210_finish_conversion(data, dspsig);
+}
+
+static int si7210_read_otp(struct i2c_client *client, u8 addr, u8 *val)
+{
+	int ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_OTP_ADDR, addr);
+	if (ret < 0)
+		return ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_OTP_CTRL,
+			       SI7210_OTP_CTRL_READ_EN);
+	if (ret < 0)
+		return ret;
+
+	return si7210_read_reg(client, SI7210_REG_OTP_DATA, val);
+}
+
+static int si7210_load_calib(struct si7210_data *data)
+{
+	struct i2c_client *client = data->client;
+	struct si7210_calib *calib = &data->calib;
+	u8 offset, gain;
+	unsigned int i;
+	int ret;
+
+	ret = si7210_read_otp(client, SI7210_OTP_TEMP_OFFSET, &offset);
+	if (ret < 0)
+		return ret;
+
+	ret = si7210_read_otp(client, SI7210_OTP_TEMP_GAIN, &gain);
+	if (ret < 0)
+		return ret;
+
+	/* offset is in 1/16 degC, gain in 1/2048 units - both signed */
+	calib->temp_offset = (s8)offset * 1000 / 16;
+	calib->temp_gain = 2048 + (s8)gain;
+
+	for (i = 0; i < ARRAY_SIZE(si7210_a_regs); i++) {
+		ret = si7210_read_otp(client, SI7210_OTP_A0_20MT + i,
+				      &calib->a[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the field is compensated by the device itself, once the
+	 * coefficients of the selected range are in place */
+	for (i = 0; i < ARRAY_SIZE(si7210_a_regs); i++) {
+		ret = si7210_write_reg(client, si7210_a_regs[i], calib->a[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Temperature in millidegrees Celsius. The 12-bit temperature code lies in
+ * bits 14:3 of DSPSIG and, according to the datasheet, the temperature is:
+ * T = -3.83e-6 * code^2 + 0.16094 * code - 279.80
+ * which is then corrected with the cached OTP gain and offset.
+ */
+static int si7210_dspsig_to_temp(const struct si7210_calib *calib, u16 dspsig)
+{
+	s64 code = dspsig >> 3;
+	s64 temp = div_s64(-383 * code * code, 100000) +
+		   div_s64(16094 * code, 100) - 279800;
+
+	return (int)((temp * calib->temp_gain) >> 11) + calib->temp_offset;
+}
+
+static u8 si7210_exp_encode(unsigned int units, unsigned int base,
+			    unsigned int mbits)
+{
+	unsigned int e = 0;
+
+	while ((units >> e) >= 2 * base && e < SI7210_EXP_MAX)
+		e++;
+	units >>= e;
+
+	return (e << mbits) | (clamp(units, base, 2 * base - 1) - base);
+}
+
+static unsigned int si7210_exp_decode(u8 reg, unsigned int base,
+				      unsigned int mbits)
+{
+	unsigned int m = reg & ((1 << mbits) - 1);
+
+	return (base + m) << (reg >> mbits);
+}
+
+/*
+ * The largest code of SW_OP and SW_HYST (SI7210_SW_OP_ZERO and
+ * SI7210_SW_HYST_ZERO) stands for zero, so larger values saturate to the
+ * code right below it.
+ */
+static u8 si7210_sw_encode(unsigned int codes, unsigned int unit,
+			   unsigned int base, unsigned int mbits)
+{
+	u8 zero = (SI7210_EXP_MAX << mbits) | ((1 << mbits) - 1);
+
+	return min_t(u8, si7210_exp_encode(codes / unit, base, mbits),
+		     zero - 1);
+}
+
+static unsigned int si7210_sw_decode(u8 reg, unsigned int unit,
+				     unsigned int base, unsigned int mbits)
+{
+	return si7210_exp_decode(reg, base, mbits) * unit;
+}
+
+static u64 si7210_sltime_to_freq(u8 sltime)
+{
+	unsigned int ticks = si7210_exp_decode(sltime, SI7210_SLTIME_BASE,
+					       SI7210_SLTIME_MBITS);
+
+	return div64_u64(1000000000000000ULL, ticks * SI7210_SLTIME_TICK_NS);
+}
+
+static u8 si7210_freq_to_sltime(u64 freq_uhz)
+{
+	u64 ticks;
+
+	/* faster rates get the shortest sleep - and can't overflow below */
+	freq_uhz = min(freq_uhz, si7210_sltime_to_freq(0));
+	ticks = div64_u64(1000000000000000ULL,
+			  freq_uhz * SI7210_SLTIME_TICK_NS);
+
+	return si7210_exp_encode(min_t(u64, ticks, UINT_MAX),
+				 SI7210_SLTIME_BASE, SI7210_SLTIME_MBITS);
+}
+
+static bool si7210_is_autonomous(struct si7210_data *data)
+{
+	return data->ev_enabled || data->samp_enabled;
+}
+
+static int si7210_write_sw_op(struct si7210_data *data)
+{
+	u8 sw_op = SI7210_SW_OP_ZERO;
+
+	if (data->ev_thresh)
+		sw_op = si7210_sw_encode(abs(data->ev_thresh),
+					 SI7210_SW_OP_UNIT, SI7210_SW_OP_BASE,
+					 SI7210_SW_OP_MBITS);
+	if (data->ev_low4field)
+		sw_op |= SI7210_SW_OP_LOW4FIELD;
+
+	return si7210_write_reg(data->client, SI7210_REG_SW_OP, sw_op);
+}
+
+static int si7210_resume_autonomous(struct si7210_data *data)
+{
+	struct i2c_client *client = data->client;
+	int ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_DSPSIGSEL,
+			       SI7210_DSPSIGSEL_FIELD);
+	if (ret < 0)
+		return ret;
+
+	return si7210_write_reg(client, SI7210_REG_POWER_CTRL,
+				SI7210_POWER_CTRL_USESTORE);
+}
+
+/*
+ * Let the device measure the field on its own, driven by the sleep timer.
+ * It then wakes up periodically, takes an averaged burst of samples and
+ * updates both DSPSIG and the comparator output without host involvement.
+ */
+static int si7210_start_autonomous(struct si7210_data *data)
+{
+	struct i2c_client *client = data->client;
+	int ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_SLTIME,
+			       data->samp_enabled ? data->sltime :
+						    SI7210_DEFAULT_SLTIME);
+	if (ret < 0)
+		return ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_SLTIMEENA,
+			       SI7210_SW_TAMPER_OFF | SI7210_SLTIMEENA_EN);
+	if (ret < 0)
+		return ret;
+
+	return si7210_resume_autonomous(data);
+}
+
+static int si7210_stop_autonomous(struct si7210_data *data)
+{
+	return si7210_write_reg(data->client, SI7210_REG_SLTIMEENA,
+				SI7210_SW_TAMPER_OFF);
+}
+
+static int si7210_set_oversampling(struct si7210_data *data,
+				   unsigned int osr_log2)
+{
+	unsigned int burstsize =
+		min_t(unsigned int, osr_log2, SI7210_DF_BURSTSIZE_MAX);
+	u8 df = (burstsize << SI7210_DF_BURSTSIZE_SHIFT) |
+		(osr_log2 << SI7210_DF_BW_SHIFT);
+	int ret;
+
+	ret = si7210_write_reg(data->client, SI7210_REG_DF, df);
+	if (ret < 0)
+		return ret;
+
+	data->osr_log2 = osr_log2;
+	return 0;
+}
+
+static int si7210_set_samp_freq(struct si7210_data *data, u64 freq_uhz)
+{
+	bool was_enabled = data->samp_enabled;
+
+	data->samp_enabled = freq_uhz != 0;
+	if (freq_uhz)
+		data->sltime = si7210_freq_to_sltime(freq_uhz);
+
+	if (si7210_is_autonomous(data))
+		return si7210_start_autonomous(data);
+	if (was_enabled)
+		return si7210_stop_autonomous(data);
+	return 0;
+}
+
+static int si7210_program_comparator(struct si7210_data *data)
+{
+	struct i2c_client *client = data->client;
+	u8 polsel, sw_hyst = SI7210_SW_HYST_ZERO;
+	int ret;
+
+	if (data->ev_type == IIO_EV_TYPE_MAG)
+		polsel = SI7210_FIELDPOLSEL_OMNI;
+	else if (data->ev_thresh < 0)
+		polsel = SI7210_FIELDPOLSEL_NEG;
+	else
+		polsel = SI7210_FIELDPOLSEL_POS;
+
+	if (data->ev_hyst)
+		sw_hyst = si7210_sw_encode(data->ev_hyst, SI7210_SW_HYST_UNIT,
+					   SI7210_SW_HYST_BASE,
+					   SI7210_SW_HYST_MBITS);
+
+	ret = si7210_write_sw_op(data);
+	if (ret < 0)
+		return ret;
+
+	ret = si7210_write_reg(client, SI7210_REG_SW_HYST,
+			       (polsel << SI7210_SW_FIELDPOLSEL_SHIFT) |
+				       sw_hyst);
+	if (ret < 0)
+		return ret;
+
+	return si7210_start_autonomous(data);
+}
+
+/*
+ * The field measurement is split into two steps, so that a sweep can start
+ * the conversions on all the sensors of a bus before fetching any result.
+ * In the autonomous mode, the latest field sample is already there and only
+ * needs to be fetched.
+ */
+static int si7210_field_start(struct si7210_data *data)
+{
+	if (si7210_is_autonomous(data))
+		return 0;
+
+	return si7210_start_conversion(data, SI7210_DSPSIGSEL_FIELD);
+}
+
+static int si7210_field_finish(struct si7210_data *data, u16 *dspsig)
+{
+	if (si7210_is_autonomous(data))
+		return si7210_fetch(data, dspsig);
+
+	return si7210_finish_conversion(data, dspsig);
+}
+
+static int si7210_read_channel(struct si7210_data *data,
+			       enum iio_chan_type type, s32 *val)
+{
+	u16 dspsig;
+	int ret;
+
+	if (type == IIO_MAGN) {
+		ret = si7210_field_start(data);
+		if (ret < 0)
+			return ret;
+
+		ret = si7210_field_finish(data, &dspsig);
+		if (ret < 0)
+			return ret;
+		*val = dspsig;
+		return 0;
+	}
+
+	ret = si7210_measure(data, SI7210_DSPSIGSEL_TEMP, &dspsig);
+	if (ret < 0)
+		return ret;
+	*val = si7210_dspsig_to_temp(&data->calib, dspsig);
+
+	/* the one-shot conversion stopped the autonomous mode, resume it */
+	if (si7210_is_autonomous(data))
+		return si7210_resume_autonomous(data);
+
+	return 0;
+}
+
+static int si7210_read_raw(struct iio_dev *indio_dev,
+			   struct iio_chan_spec const *chan, int *val,
+			   int *val2, long mask)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+	u64 freq_uhz;
+	u32 freq_rem;
+	s32 raw;
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		mutex_lock(&data->lock);
+		ret = si7210_read_channel(data, chan->type, &raw);
+		mutex_unlock(&data->lock);
+		if (ret < 0)
+			return ret;
+		*val = raw;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_OFFSET:
+		/* only the field channel has an offset */
+		*val = -SI7210_FIELD_ZERO;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		if (chan->type == IIO_TEMP) {
+			/* the temperature is linearized by the driver */
+			*val = 1;
+			return IIO_VAL_INT;
+		}
+		/* 20mT range: 0.00125 mT (0.0125 G) per LSB */
+		*val = 0;
+		*val2 = 12500;
+		return IIO_VAL_INT_PLUS_MICRO;
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		/* 0 means that every read triggers a one-shot conversion */
+		mutex_lock(&data->lock);
+		freq_uhz = data->samp_enabled ?
+				   si7210_sltime_to_freq(data->sltime) :
+				   0;
+		mutex_unlock(&data->lock);
+		*val = div_u64_rem(freq_uhz, 1000000, &freq_rem);
+		*val2 = freq_rem;
+		return IIO_VAL_INT_PLUS_MICRO;
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		*val = 1 << data->osr_log2;
+		return IIO_VAL_INT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int si7210_write_raw(struct iio_dev *indio_dev,
+			    struct iio_chan_spec const *chan, int val,
+			    int val2, long mask)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		if (val < 0 || val2 < 0)
+			return -EINVAL;
+		mutex_lock(&data->lock);
+		ret = si7210_set_samp_freq(data, (u64)val * 1000000 + val2);
+		mutex_unlock(&data->lock);
+		return ret;
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		if (val <= 0 || !is_power_of_2(val) ||
+		    ilog2(val) > SI7210_DF_BW_MAX)
+			return -EINVAL;
+		mutex_lock(&data->lock);
+		ret = si7210_set_oversampling(data, ilog2(val));
+		mutex_unlock(&data->lock);
+		return ret;
+	default:
+		return -EINVAL;
+	}
+}
+
+static irqreturn_t si7210_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct si7210_data *data = iio_priv(indio_dev);
+	unsigned int i = 0;
+	int bit, ret;
+
+	mutex_lock(&data->lock);
+	for_each_set_bit(bit, indio_dev->active_scan_mask, SI7210_SCAN_TS) {
+		ret = si7210_read_channel(data, indio_dev->channels[bit].type,
+					  &data->scan.chan[i++]);
+		if (ret < 0)
+			goto out;
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &data->scan,
+					   pf->timestamp);
+out:
+	mutex_unlock(&data->lock);
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * The comparator output toggles the IRQ line once the field goes past the
+ * threshold. The output polarity is then inverted, so that the line is
+ * released until the field crosses the threshold (minus hysteresis) back.
+ */
+static irqreturn_t si7210_irq_thread(int irq, void *p)
+{
+	struct iio_dev *indio_dev = p;
+	struct si7210_data *data = iio_priv(indio_dev);
+	s64 timestamp = iio_get_time_ns(indio_dev);
+	enum iio_event_direction dir;
+	enum iio_event_type type;
+	bool entered, positive;
+
+	mutex_lock(&data->lock);
+	if (!data->ev_enabled) {
+		mutex_unlock(&data->lock);
+		return IRQ_NONE;
+	}
+
+	entered = !data->ev_low4field;
+	data->ev_low4field = entered;
+	si7210_write_sw_op(data);
+
+	type = data->ev_type;
+	positive = type == IIO_EV_TYPE_MAG || data->ev_thresh >= 0;
+	mutex_unlock(&data->lock);
+
+	dir = entered == positive ? IIO_EV_DIR_RISING : IIO_EV_DIR_FALLING;
+	iio_push_event(indio_dev,
+		       IIO_MOD_EVENT_CODE(IIO_MAGN, 0, IIO_MOD_Z, type, dir),
+		       timestamp);
+
+	return IRQ_HANDLED;
+}
+
+static int si7210_read_event_config(struct iio_dev *indio_dev,
+				    const struct iio_chan_spec *chan,
+				    enum iio_event_type type,
+				    enum iio_event_direction dir)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+
+	return data->ev_enabled && data->ev_type == type;
+}
+
+static int si7210_write_event_config(struct iio_dev *indio_dev,
+				     const struct iio_chan_spec *chan,
+				     enum iio_event_type type,
+				     enum iio_event_direction dir, int state)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+	bool was_enabled;
+	int ret = 0;
+
+	if (data->client->irq <= 0)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&data->lock);
+	was_enabled = data->ev_enabled;
+	if (state) {
+		/* there is a single comparator - the last enabled type wins */
+		data->ev_type = type;
+		data->ev_low4field = false;
+		ret = si7210_program_comparator(data);
+		data->ev_enabled = !ret;
+	} else if (data->ev_enabled && data->ev_type == type) {
+		data->ev_enabled = false;
+		if (!si7210_is_autonomous(data))
+			ret = si7210_stop_autonomous(data);
+	}
+	mutex_unlock(&data->lock);
+
+	/* the threaded handler takes the lock, so don't hold it here */
+	if (!was_enabled && data->ev_enabled)
+		enable_irq(data->client->irq);
+	else if (was_enabled && !data->ev_enabled)
+		disable_irq(data->client->irq);
+
+	return ret;
+}
+
+static int si7210_read_event_value(struct iio_dev *indio_dev,
+				   const struct iio_chan_spec *chan,
+				   enum iio_event_type type,
+				   enum iio_event_direction dir,
+				   enum iio_event_info info, int *val,
+				   int *val2)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+	u8 sw_op, sw_hyst;
+
+	/* report the values that the comparator really uses */
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		if (!data->ev_thresh) {
+			*val = 0;
+			return IIO_VAL_INT;
+		}
+		sw_op = si7210_sw_encode(abs(data->ev_thresh),
+					 SI7210_SW_OP_UNIT, SI7210_SW_OP_BASE,
+					 SI7210_SW_OP_MBITS);
+		*val = si7210_sw_decode(sw_op, SI7210_SW_OP_UNIT,
+					SI7210_SW_OP_BASE, SI7210_SW_OP_MBITS);
+		if (type == IIO_EV_TYPE_THRESH && data->ev_thresh < 0)
+			*val = -*val;
+		return IIO_VAL_INT;
+	case IIO_EV_INFO_HYSTERESIS:
+		if (!data->ev_hyst) {
+			*val = 0;
+			return IIO_VAL_INT;
+		}
+		sw_hyst = si7210_sw_encode(data->ev_hyst, SI7210_SW_HYST_UNIT,
+					   SI7210_SW_HYST_BASE,
+					   SI7210_SW_HYST_MBITS);
+		*val = si7210_sw_decode(sw_hyst, SI7210_SW_HYST_UNIT,
+					SI7210_SW_HYST_BASE,
+					SI7210_SW_HYST_MBITS);
+		return IIO_VAL_INT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int si7210_write_event_value(struct iio_dev *indio_dev,
+				    const struct iio_chan_spec *chan,
+				    enum iio_event_type type,
+				    enum iio_event_direction dir,
+				    enum iio_event_info info, int val,
+				    int val2)
+{
+	struct si7210_data *data = iio_priv(indio_dev);
+	int ret = 0;
+
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		if (type == IIO_EV_TYPE_MAG && val < 0)
+			return -EINVAL;
+		break;
+	case IIO_EV_INFO_HYSTERESIS:
+		if (val < 0)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&data->lock);
+	if (info == IIO_EV_INFO_VALUE)
+		data->ev_thresh = val;
+	else
+		data->ev_hyst = val;
+	if (data->ev_enabled && data->ev_type == type)
+		ret = si7210_program_comparator(data);
+	mutex_unlock(&data->lock);
+
+	return ret;
+}
+
+/*
+ * THRESH events use a unipolar comparator (the sign of the threshold selects
+ * the polarity of the field), while MAG events compare the field magnitude.
+ * Thresholds and hysteresis are expressed in field codes, like the raw value.
+ */
+static const struct iio_event_spec si7210_events[] = {
+	{
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_EITHER,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				 BIT(IIO_EV_INFO_HYSTERESIS) |
+				 BIT(IIO_EV_INFO_ENABLE),
+	},
+	{
+		.type = IIO_EV_TYPE_MAG,
+		.dir = IIO_EV_DIR_EITHER,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				 BIT(IIO_EV_INFO_HYSTERESIS) |
+				 BIT(IIO_EV_INFO_ENABLE),
+	},
+};
+
+static const struct iio_chan_spec si7210_channels[] = {
+	{
+		.type = IIO_MAGN,
+		.modified = 1,
+		.channel2 = IIO_MOD_Z,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
+				      BIT(IIO_CHAN_INFO_OFFSET) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),
+		.event_spec = si7210_events,
+		.num_event_specs = ARRAY_SIZE(si7210_events),
+		.scan_index = SI7210_SCAN_FIELD,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 15,
+			.storagebits = 32,
+			.endianness = IIO_CPU,
+		},
+	},
+	{
+		.type = IIO_TEMP,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
+				      BIT(IIO_CHAN_INFO_SCALE),
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),
+		.scan_index = SI7210_SCAN_TEMP,
+		.scan_type = {
+			.sign = 's',
+			.realbits = 32,
+			.storagebits = 32,
+			.endianness = IIO_CPU,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(SI7210_SCAN_TS),
+};
+
+static const struct iio_info si7210_info = {
+	.read_raw = si7210_read_raw,
+	.write_raw = si7210_write_raw,
+	.read_event_config = si7210_read_event_config,
+	.write_event_config = si7210_write_event_config,
+	.read_event_value = si7210_read_event_value,
+	.write_event_value = si7210_write_event_value,
+};
+
+struct si7210_sweep_entry {
+	struct si7210_data *data;
+	struct si7210_record record;
+};
+
+/*
+ * All the entries of a single job refer to the sensors on the same bus. The
+ * job holds the locks of all of them at once, always taking them in the
+ * order of the entries; `lock` tells lockdep they nest under the job.
+ */
+struct si7210_sweep_job {
+	struct work_struct work;
+	struct mutex lock;
+	struct si7210_sweep_entry *entries;
+	unsigned int nentries;
+};
+
+static void si7210_sweep_work(struct work_struct *work)
+{
+	struct si7210_sweep_job *job =
+		container_of(work, struct si7210_sweep_job, work);
+	struct si7210_sweep_entry *entry, *end = job->entries + job->nentries;
+	u16 dspsig;
+
+	mutex_lock(&job->lock);
+	for (entry = job->entries; entry < end; entry++)
+		mutex_lock_nest_lock(&entry->data->lock, &job->lock);
+
+	/* interleave the transfers: let all the sensors convert at once */
+	for (entry = job->entries; entry < end; entry++)
+		entry->record.status = si7210_field_start(entry->data);
+
+	for (entry = job->entries; entry < end; entry++) {
+		struct si7210_record *record = &entry->record;
+
+		if (record->status < 0)
+			continue;
+
+		record->status = si7210_field_finish(entry->data, &dspsig);
+		if (record->status < 0)
+			continue;
+
+		record->timestamp_ns = ktime_get_ns();
+		record->field_nt = ((int)dspsig - SI7210_FIELD_ZERO) *
+				   SI7210_FIELD_CODE_NT;
+	}
+
+	for (entry = job->entries; entry < end; entry++)
+		mutex_unlock(&entry->data->lock);
+	mutex_unlock(&job->lock);
+}
+
+/*
+ * The entries are sorted by bus and then by address, so concurrent sweeps
+ * take the locks of the sensors in the same order.
+ */
+static int si7210_sweep_entry_cmp(const void *a, const void *b)
+{
+	const struct si7210_sweep_entry *ea = a, *eb = b;
+
+	if (ea->record.bus != eb->record.bus)
+		return (int)ea->record.bus - (int)eb->record.bus;
+	return (int)ea->record.addr - (int)eb->record.addr;
+}
+
+/*
+ * Every read of the "si7210-all" node samples the field of all the sensors
+ * in a single round. The sensors are grouped by bus and each bus is handled
+ * by a separate work on the unbound workqueue, so the buses are accessed in
+ * parallel, while on each bus the transfers to different sensors are
+ * interleaved. One struct si7210_record is returned for each sensor that
+ * fits in the user's buffer.
+ */
+static ssize_t si7210_all_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *offset)
+{
+	struct si7210_sweep_entry *entries;
+	struct si7210_sweep_job *jobs;
+	struct si7210_data *data;
+	unsigned int i, first, nentries = 0, njobs = 0;
+	ssize_t ret = 0;
+
+	if (count < sizeof(struct si7210_record))
+		return -EINVAL;
+
+	down_read(&si7210_devices_sem);
+
+	list_for_each_entry(data, &si7210_devices, node)
+		nentries++;
+	nentries = min_t(unsigned int, nentries,
+			 count / sizeof(struct si7210_record));
+	if (!nentries)
+		goto out_unlock;
+
+	entries = kcalloc(nentries, sizeof(*entries), GFP_KERNEL);
+	jobs = kcalloc(nentries, sizeof(*jobs), GFP_KERNEL);
+	if (!entries || !jobs) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	i = 0;
+	list_for_each_entry(data, &si7210_devices, node) {
+		if (i == nentries)
+			break;
+		entries[i].data = data;
+		entries[i].record.bus = i2c_adapter_id(data->client->adapter);
+		entries[i].record.addr = data->client->addr;
+		i++;
+	}
+	sort(entries, nentries, sizeof(*entries), si7210_sweep_entry_cmp,
+	     NULL);
+
+	for (first = 0, i = 1; i <= nentries; i++) {
+		if (i < nentries &&
+		    entries[i].record.bus == entries[first].record.bus)
+			continue;
+
+		jobs[njobs].entries = &entries[first];
+		jobs[njobs].nentries = i - first;
+		mutex_init(&jobs[njobs].lock);
+		INIT_WORK(&jobs[njobs].work, si7210_sweep_work);
+		queue_work(system_unbound_wq, &jobs[njobs].work);
+		njobs++;
+		first = i;
+	}
+
+	for (i = 0; i < njobs; i++)
+		flush_work(&jobs[i].work);
+
+	for (i = 0; i < nentries; i++) {
+		if (copy_to_user(buf + ret, &entries[i].record,
+				 sizeof(entries[i].record))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret += sizeof(entries[i].record);
+	}
+
+out_free:
+	kfree(jobs);
+	kfree(entries);
+out_unlock:
+	up_read(&si7210_devices_sem);
+	return ret;
+}
+
+const struct file_operations si7210_all_fops = { .owner = THIS_MODULE,
+						 .read = si7210_all_read };
+
+static int si7210_device_init(struct si7210_data *data)
+{
+	struct i2c_client *client = data->client;
+	u8 hrevid;
+	int ret;
+
+	/* the device might be asleep - the first transfer only wakes it up,
+	 * so its result is ignored */
+	i2c_smbus_read_byte(client);
+
+	ret = si7210_read_reg(client, SI7210_REG_HREVID, &hrevid);
+	if (ret < 0)
+		return ret;
+	if (SI7210_HREVID_CHIP_ID(hrevid) != SI7210_CHIP_ID) {
+		dev_err(&client->dev, "unexpected chip id: 0x%x\n", hrevid);
+		return -ENODEV;
+	}
+
+	ret = si7210_write_reg(client, SI7210_REG_ARAUTOINC,
+			       SI7210_ARAUTOINC_EN);
+	if (ret < 0)
+		return ret;
+
+	ret = si7210_load_calib(data);
+	if (ret < 0)
+		return ret;
+
+	/* no averaging by default */
+	return si7210_set_oversampling(data, 0);
+}
+
+/*
+ * Stop the sleep timer once the device is unbound, so that it does not keep
+ * measuring and driving the comparator output. Registered before the IIO
+ * device, so it runs after userspace can no longer enable it again.
+ */
+static void si7210_disable_autonomous(void *data)
+{
+	struct si7210_data *si7210 = data;
+
+	mutex_lock(&si7210->lock);
+	si7210_stop_autonomous(si7210);
+	mutex_unlock(&si7210->lock);
+}
+
+static int si7210_probe(struct i2c_client *client,
+			const struct i2c_device_id *id)
+{
+	struct si7210_data *data;
+	struct iio_dev *indio_dev;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(&client->dev, sizeof(*data));
+	if (!indio_dev)
+		return dev_err_probe(&client->dev, -ENOMEM,
+				     "unable to allocate driver data\n");
+
+	data = iio_priv(indio_dev);
+	data->client = client;
+
+	mutex_init(&data->lock);
+
+	ret = si7210_device_init(data);
+	if (ret < 0)
+		return dev_err_probe(&client->dev, ret,
+				     "device initialization failed\n");
+
+	ret = devm_add_action_or_reset(&client->dev, si7210_disable_autonomous,
+				       data);
+	if (ret < 0)
+		return ret;
+
+	indio_dev->name = "si7210";
+	indio_dev->info = &si7210_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = si7210_channels;
+	indio_dev->num_channels = ARRAY_SIZE(si7210_channels);
+
+	ret = devm_iio_triggered_buffer_setup(&client->dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      si7210_trigger_handler, NULL);
+	if (ret < 0)
+		return dev_err_probe(&client->dev, ret,
+				     "cannot setup triggered buffer\n");
+
+	/* the comparator output pin is optional, the IRQ is enabled only
+	 * once an event is */
+	if (client->irq > 0) {
+		irq_set_status_flags(client->irq, IRQ_NOAUTOEN);
+		ret = devm_request_threaded_irq(&client->dev, client->irq, NULL,
+						si7210_irq_thread, IRQF_ONESHOT,
+						"si7210", indio_dev);
+		if (ret < 0)
+			return dev_err_probe(&client->dev, ret,
+					     "failed to request interrupt\n");
+	}
+
+	ret = devm_iio_device_register(&client->dev, indio_dev);
+	if (ret < 0)
+		return dev_err_probe(&client->dev, ret,
+				     "cannot register iio device\n");
+
+	i2c_set_clientdata(client, data);
+
+	down_write(&si7210_devices_sem);
+	list_add_tail(&data->node, &si7210_devices);
+	up_write(&si7210_devices_sem);
+
+	dev_info(&client->dev, "successful probe of device: %s\n",
+		 client->name);
+	return 0;
+}
+
+static const struct of_device_id si7210_dt_ids[] = { { .compatible = "si7210" },
+						     {} };
+MODULE_DEVICE_TABLE(of, si7210_dt_ids);
+
+static int si7210_remove(struct i2c_client *client)
+{
+	struct si7210_data *data = i2c_get_clientdata(client);
+
+	down_write(&si7210_devices_sem);
+	list_del(&data->node);
+	up_write(&si7210_devices_sem);
+
+	return 0;
+}
+
+static struct i2c_driver si7210_driver = {
+	.driver = {
+		.name = "si7210",
+		.of_match_table = si7210_dt_ids,
+	},
+	.probe = si7210_probe,
+	.remove = si7210_remove,
+};
 
 static int __init si7210_init(void)
 {
-	printk(KERN_INFO "s7210_driver registration\n");
+	int ret;
+	dev_t dev;
+
+	ret = alloc_chrdev_region(&dev, 0, 1, "si7210_driver");
+	if (ret != 0) {
+		printk(KERN_ERR
+		       "si7210_driver: cannot allocate chrdev region\n");
+		return ret;
+	}
+	si7210_major = MAJOR(dev);
+
+	si7210_class = class_create(THIS_MODULE, "magnetic");
+	if (IS_ERR(si7210_class)) {
+		printk(KERN_ERR "si7210_driver: cannot create si7210 class\n");
+		ret = PTR_ERR(si7210_class);
+		goto err_unreg;
+	}
+
+	cdev_init(&si7210_all_cdev, &si7210_all_fops);
+	ret = cdev_add(&si7210_all_cdev, dev, 1);
+	if (ret) {
+		printk(KERN_ERR "si7210_driver: cdev_add failed\n");
+		goto err_cls;
+	}
+
+	if (IS_ERR(device_create(si7210_class, NULL, dev, NULL, "si7210-all")))
+		printk(KERN_ERR "si7210_driver: cannot create char device\n");
+
+	ret = i2c_add_driver(&si7210_driver);
+	if (ret) {
+		printk(KERN_ERR
+		       "si7210_driver: error while registering the driver\n");
+		goto err_all_del;
+	}
+
+	printk(KERN_INFO "si7210_driver: successfully registered\n");
 	return 0;
+
+err_all_del:
+	device_destroy(si7210_class, dev);
+	cdev_del(&si7210_all_cdev);
+err_cls:
+	class_destroy(si7210_class);
+err_unreg:
+	unregister_chrdev_region(dev, 1);
+	return ret;
 }
 
 static void __exit si7210_cleanup(void)
 {
 	printk(KERN_INFO "si7210_driver removal\n");
+
+	i2c_del_driver(&si7210_driver);
+	device_destroy(si7210_class, MKDEV(si7210_major, 0));
+	cdev_del(&si7210_all_cdev);
+	class_destroy(si7210_class);
+	unregister_chrdev_region(MKDEV(si7210_major, 0), 1);
 }
 
 module_init(si7210_init);
@@ -0,0 +1,13 @@
+#ifndef _SI7210_H
+#define _SI7210_H
+
+/* A single entry of the array returned by a read of /dev/si7210-all */
+struct si7210_record {
+	unsigned short bus; /* number of the I2C adapter */
+	unsigned short addr; /* I2C address of the sensor */
+	int status; /* 0 or a negative error code of the measurement */
+	long long timestamp_ns; /* CLOCK_MONOTONIC completion time */
+	int field_nt; /* magnetic field in nT */
+};
+
+#endif /* _SI7210_H */
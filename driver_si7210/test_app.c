@@ -1,7 +1,329 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
-int main()
+#define IIO_DEVICES_DIR "/sys/bus/iio/devices"
+#define CONFIGFS_DIR "/sys/kernel/config"
+#define TRIGGER_NAME "si7210-bench"
+#define TRIGGER_DIR CONFIGFS_DIR "/iio/triggers/hrtimer/" TRIGGER_NAME
+
+#define MAX_DEVICES 16
+#define BUFFER_LENGTH 256
+#define FIELD_MAX 0x7FFF
+
+/* Layout of a buffer scan with the field and the timestamp enabled */
+struct si7210_scan {
+	unsigned int field;
+	int pad;
+	long long timestamp;
+};
+
+struct bench_config {
+	unsigned int duration_s;
+	unsigned int rate_hz;
+	/* 0 - one-shot conversions; otherwise the autonomous mode is used */
+	unsigned int osr;
+};
+
+struct cpu_stat {
+	unsigned long long busy;
+	unsigned long long total;
+};
+
+static char dev_dir[64];
+static char trig_dir[64];
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void write_attr(const char *dir, const char *attr, const char *value)
+{
+	char path[128];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+		fprintf(stderr, "si7210: cannot write %s to %s\n", value, path);
+		exit(1);
+	}
+	close(fd);
+}
+
+static void write_attr_uint(const char *dir, const char *attr,
+			    unsigned int value)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%u", value);
+	write_attr(dir, attr, buf);
+}
+
+static int read_attr(const char *dir, const char *attr, char *value,
+		     size_t size)
+{
+	char path[128];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, value, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	/* strip the trailing newline */
+	while (len > 0 && value[len - 1] == '\n')
+		len--;
+	value[len] = '\0';
+	return 0;
+}
+
+/* Look for an entry of IIO_DEVICES_DIR called `prefix`N with the given name */
+static int find_iio_entry(const char *prefix, const char *name, char *dir,
+			  size_t size)
+{
+	char entry_name[32];
+	int i;
+
+	for (i = 0; i < MAX_DEVICES; i++) {
+		snprintf(dir, size, "%s/%s%d", IIO_DEVICES_DIR, prefix, i);
+		if (read_attr(dir, "name", entry_name, sizeof(entry_name)))
+			continue;
+		if (!strcmp(entry_name, name))
+			return i;
+	}
+	return -1;
+}
+
+static void read_cpu_stat(struct cpu_stat *stat)
+{
+	unsigned long long val[8] = { 0 };
+	FILE *file;
+
+	file = fopen("/proc/stat", "r");
+	assert(file);
+	/* user nice system idle iowait irq softirq steal */
+	assert(fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		      &val[0], &val[1], &val[2], &val[3], &val[4], &val[5],
+		      &val[6], &val[7]) == 8);
+	fclose(file);
+
+	stat->total = val[0] + val[1] + val[2] + val[3] + val[4] + val[5] +
+		      val[6] + val[7];
+	stat->busy = stat->total - val[3] - val[4];
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long la = *(const long long *)a, lb = *(const long long *)b;
+
+	return (la > lb) - (la < lb);
+}
+
+static long long percentile(const long long *sorted, unsigned int n,
+			    unsigned int pct)
 {
-	printf("Hello world!\n");
+	return n ? sorted[(unsigned long long)(n - 1) * pct / 100] : 0;
+}
+
+static void setup(const struct bench_config *cfg)
+{
+	int dev, trig;
+
+	printf("%s running...\n", __func__);
+
+	dev = find_iio_entry("iio:device", "si7210", dev_dir, sizeof(dev_dir));
+	if (dev < 0) {
+		fprintf(stderr, "si7210: no si7210 iio device found\n");
+		exit(1);
+	}
+
+	/* configfs may already be mounted */
+	if (mount("none", CONFIGFS_DIR, "configfs", 0, NULL) &&
+	    errno != EBUSY) {
+		perror("si7210: cannot mount configfs");
+		exit(1);
+	}
+	if (mkdir(TRIGGER_DIR, 0755) && errno != EEXIST) {
+		perror("si7210: cannot create the hrtimer trigger");
+		exit(1);
+	}
+	trig = find_iio_entry("trigger", TRIGGER_NAME, trig_dir,
+			      sizeof(trig_dir));
+	assert(trig >= 0);
+
+	write_attr_uint(trig_dir, "sampling_frequency", cfg->rate_hz);
+
+	/* the latencies are measured against CLOCK_MONOTONIC */
+	write_attr(dev_dir, "current_timestamp_clock", "monotonic\n");
+	if (cfg->osr) {
+		write_attr_uint(dev_dir, "in_magn_z_oversampling_ratio",
+				cfg->osr);
+		write_attr_uint(dev_dir, "sampling_frequency", cfg->rate_hz);
+	} else {
+		write_attr_uint(dev_dir, "sampling_frequency", 0);
+	}
+
+	write_attr(dev_dir, "trigger/current_trigger", TRIGGER_NAME);
+	write_attr_uint(dev_dir, "scan_elements/in_magn_z_en", 1);
+	write_attr_uint(dev_dir, "scan_elements/in_temp_en", 0);
+	write_attr_uint(dev_dir, "scan_elements/in_timestamp_en", 1);
+	write_attr_uint(dev_dir, "buffer/length", BUFFER_LENGTH);
+
+	printf("%s succeeded!\n", __func__);
+}
+
+static void teardown(void)
+{
+	write_attr_uint(dev_dir, "buffer/enable", 0);
+	write_attr(dev_dir, "trigger/current_trigger", "\n");
+	write_attr_uint(dev_dir, "sampling_frequency", 0);
+	rmdir(TRIGGER_DIR);
+}
+
+/*
+ * Stream the samples for the configured time and print a single line with
+ * the results, as a JSON object, so that the runs can be compared by scripts:
+ * - rate_mhz - achieved sample rate,
+ * - dropped - samples missing from the stream, judging by the timestamps,
+ * - lat_*_us - distribution of the latency between the trigger and the
+ *   moment the sample reaches the application,
+ * - cpu_*_us - CPU time of this process; cpu_load_pct - load of the whole
+ *   system, which covers the kernel threads doing the actual sampling.
+ */
+static void test_stream(const struct bench_config *cfg)
+{
+	unsigned int max_samples = cfg->duration_s * cfg->rate_hz * 2 + 16;
+	struct si7210_scan scans[BUFFER_LENGTH / 4];
+	long long *latencies, period_ns, start, end, prev_ts = 0, gap;
+	long long lat_sum = 0;
+	unsigned int nsamples = 0, nstored, dropped = 0, i;
+	struct cpu_stat cpu_start, cpu_end;
+	struct rusage usage;
+	struct pollfd pfd;
+	char dev_path[32];
+	ssize_t size;
+
+	printf("%s running...\n", __func__);
+
+	latencies = calloc(max_samples, sizeof(*latencies));
+	assert(latencies);
+	period_ns = 1000000000LL / cfg->rate_hz;
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s",
+		 strrchr(dev_dir, '/') + 1);
+	pfd.fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+	assert(pfd.fd > 0);
+	pfd.events = POLLIN;
+
+	read_cpu_stat(&cpu_start);
+	write_attr_uint(dev_dir, "buffer/enable", 1);
+	start = now_ns();
+	end = start + cfg->duration_s * 1000000000LL;
+
+	while (now_ns() < end) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		size = read(pfd.fd, scans, sizeof(scans));
+		if (size < 0) {
+			assert(errno == EAGAIN);
+			continue;
+		}
+		assert(size % sizeof(scans[0]) == 0);
+
+		for (i = 0; i < size / sizeof(scans[0]); i++) {
+			long long latency = now_ns() - scans[i].timestamp;
+
+			assert(scans[i].field <= FIELD_MAX);
+			assert(scans[i].timestamp > prev_ts);
+
+			/* a gap of more than 1.5 periods means lost samples */
+			gap = scans[i].timestamp - prev_ts;
+			if (prev_ts && gap > period_ns * 3 / 2)
+				dropped +=
+					(gap + period_ns / 2) / period_ns - 1;
+			prev_ts = scans[i].timestamp;
+
+			if (nsamples < max_samples)
+				latencies[nsamples] = latency;
+			lat_sum += latency;
+			nsamples++;
+		}
+	}
+
+	write_attr_uint(dev_dir, "buffer/enable", 0);
+	end = now_ns();
+	read_cpu_stat(&cpu_end);
+	getrusage(RUSAGE_SELF, &usage);
+	close(pfd.fd);
+
+	assert(nsamples > 0);
+	nstored = nsamples < max_samples ? nsamples : max_samples;
+	qsort(latencies, nstored, sizeof(*latencies), cmp_ll);
+
+	printf("{\"rate_hz\": %u, \"osr\": %u, \"duration_ms\": %lld, "
+	       "\"samples\": %u, \"rate_mhz\": %lld, \"dropped\": %u, "
+	       "\"lat_min_us\": %lld, \"lat_avg_us\": %lld, "
+	       "\"lat_p50_us\": %lld, \"lat_p90_us\": %lld, "
+	       "\"lat_p99_us\": %lld, \"lat_max_us\": %lld, "
+	       "\"cpu_user_us\": %lld, \"cpu_sys_us\": %lld, "
+	       "\"cpu_load_pct\": %llu}\n",
+	       cfg->rate_hz, cfg->osr, (end - start) / 1000000, nsamples,
+	       nsamples * 1000000000000LL / (end - start), dropped,
+	       latencies[0] / 1000, lat_sum / nsamples / 1000,
+	       percentile(latencies, nstored, 50) / 1000,
+	       percentile(latencies, nstored, 90) / 1000,
+	       percentile(latencies, nstored, 99) / 1000,
+	       latencies[nstored - 1] / 1000,
+	       usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec,
+	       usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec,
+	       (cpu_end.busy - cpu_start.busy) * 100 /
+		       (cpu_end.total - cpu_start.total + 1));
+
+	free(latencies);
+
+	printf("%s succeeded!\n", __func__);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_config cfg = { .duration_s = 10, .rate_hz = 100 };
+
+	if (argc > 4) {
+		fprintf(stderr, "usage: %s [duration_s] [rate_hz] [osr]\n",
+			argv[0]);
+		return 1;
+	}
+	if (argc > 1)
+		cfg.duration_s = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		cfg.rate_hz = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		cfg.osr = strtoul(argv[3], NULL, 0);
+	assert(cfg.duration_s > 0 && cfg.rate_hz > 0);
+
+	setup(&cfg);
+	test_stream(&cfg);
+	teardown();
+
 	return 0;
 }
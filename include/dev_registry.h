@@ -0,0 +1,56 @@
+#ifndef _DEV_REGISTRY_H
+#define _DEV_REGISTRY_H
+
+#include <linux/xarray.h>
+
+/*
+ * Registry of the devices handled by a driver, which assigns each of them
+ * the minor number of its character device. The minors are kept in an
+ * allocating xarray, so they are allocated (lowest free first) and released
+ * safely from concurrent probes and removals, without any additional locking
+ * in the drivers.
+ *
+ * The header is included by every driver that needs it, so each module gets
+ * its own copy of the code and no additional module has to be loaded.
+ */
+
+/* Default number of minors reserved by a driver */
+#define DEV_REGISTRY_MAX_MINORS 256
+
+struct dev_registry {
+	struct xarray devices;
+	unsigned int max_minors;
+};
+
+#define DEFINE_DEV_REGISTRY(name, max)                                        \
+	struct dev_registry name = {                                          \
+		.devices = XARRAY_INIT(name.devices, XA_FLAGS_ALLOC),         \
+		.max_minors = (max),                                          \
+	}
+
+/* Register `data` and return its minor or a negative error code */
+static inline int dev_registry_add(struct dev_registry *reg, void *data)
+{
+	u32 minor;
+	int ret;
+
+	ret = xa_alloc(&reg->devices, &minor, data,
+		       XA_LIMIT(0, reg->max_minors - 1), GFP_KERNEL);
+	if (ret < 0)
+		return ret;
+
+	return minor;
+}
+
+static inline void dev_registry_remove(struct dev_registry *reg,
+				       unsigned int minor)
+{
+	xa_erase(&reg->devices, minor);
+}
+
+static inline void dev_registry_destroy(struct dev_registry *reg)
+{
+	xa_destroy(&reg->devices);
+}
+
+#endif /* _DEV_REGISTRY_H */
@@ -0,0 +1,178 @@
+#ifndef _STRESS_H
+#define _STRESS_H
+
+/*
+ * Userspace harness shared by the stress applications of the drivers.
+ *
+ * A stress application provides a set of callbacks, which are called by
+ * many threads at once. The same workload is run for an increasing number of
+ * threads (1, 2, 4, ... up to the number of online harts), each thread pinned
+ * to its own hart, and a single JSON line is printed per run, so that the
+ * throughput scaling can be compared between the runs and the platforms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Values returned by stress_ops.iter */
+#define STRESS_OK 0
+/* the device was busy (e.g. opened by another thread) - not an error */
+#define STRESS_BUSY 1
+/* a lost update or an inconsistent state was detected */
+#define STRESS_LOST -1
+
+struct stress_thread {
+	pthread_t tid;
+	unsigned int id;
+	unsigned int nthreads;
+	unsigned long long ops;
+	unsigned long long busy;
+	unsigned long long lost;
+	/* state of the application, private to the thread */
+	int fd;
+	unsigned int seed;
+};
+
+struct stress_ops {
+	const char *name;
+	/* optional; called once by each thread before the first iteration */
+	int (*init)(struct stress_thread *thread);
+	/* a single operation; returns one of STRESS_* values */
+	int (*iter)(struct stress_thread *thread);
+	/* optional; called once by each thread after the last iteration */
+	void (*fini)(struct stress_thread *thread);
+};
+
+static const struct stress_ops *stress_ops;
+static volatile int stress_stop;
+
+static inline long long stress_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *stress_thread_fn(void *arg)
+{
+	struct stress_thread *thread = arg;
+	cpu_set_t cpus;
+	int ret;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(thread->id, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	if (stress_ops->init && stress_ops->init(thread)) {
+		thread->lost++;
+		return NULL;
+	}
+
+	while (!stress_stop) {
+		ret = stress_ops->iter(thread);
+		if (ret == STRESS_OK)
+			thread->ops++;
+		else if (ret == STRESS_BUSY)
+			thread->busy++;
+		else
+			thread->lost++;
+	}
+
+	if (stress_ops->fini)
+		stress_ops->fini(thread);
+	return NULL;
+}
+
+/* Run the workload on `nthreads` threads; returns the number of operations */
+static unsigned long long stress_run_once(unsigned int nthreads,
+					  unsigned int duration_s,
+					  unsigned long long base_ops,
+					  unsigned long long *lost)
+{
+	struct stress_thread *threads;
+	unsigned long long ops = 0, busy = 0;
+	long long start, elapsed;
+	unsigned int i;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "stress: cannot allocate threads\n");
+		exit(1);
+	}
+
+	stress_stop = 0;
+	start = stress_now_ns();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].id = i;
+		threads[i].nthreads = nthreads;
+		threads[i].fd = -1;
+		threads[i].seed = i + 1;
+		if (pthread_create(&threads[i].tid, NULL, stress_thread_fn,
+				   &threads[i])) {
+			fprintf(stderr, "stress: cannot create a thread\n");
+			exit(1);
+		}
+	}
+
+	sleep(duration_s);
+	stress_stop = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		busy += threads[i].busy;
+		*lost += threads[i].lost;
+	}
+	elapsed = stress_now_ns() - start;
+
+	printf("{\"driver\": \"%s\", \"threads\": %u, \"ops\": %llu, "
+	       "\"ops_per_s\": %llu, \"speedup_pct\": %llu, \"busy\": %llu, "
+	       "\"lost\": %llu}\n",
+	       stress_ops->name, nthreads, ops,
+	       ops * 1000000000ULL / elapsed,
+	       base_ops ? ops * 100 / base_ops : 100, busy, *lost);
+	fflush(stdout);
+
+	free(threads);
+	return ops;
+}
+
+/*
+ * Run the workload for 1, 2, 4, ... threads, up to the number of harts.
+ * Returns the total number of lost updates, which should be 0.
+ */
+static unsigned long long stress_run(const struct stress_ops *ops,
+				     unsigned int duration_s)
+{
+	long harts = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long base_ops = 0, lost = 0, run_lost, run_ops;
+	unsigned int nthreads = 1;
+
+	stress_ops = ops;
+	if (harts < 1)
+		harts = 1;
+
+	for (;;) {
+		run_lost = 0;
+		run_ops = stress_run_once(nthreads, duration_s, base_ops,
+					  &run_lost);
+		if (nthreads == 1)
+			base_ops = run_ops;
+		lost += run_lost;
+
+		if (nthreads == harts)
+			break;
+		nthreads = nthreads * 2 < harts ? nthreads * 2 : harts;
+	}
+
+	return lost;
+}
+
+#endif /* _STRESS_H */
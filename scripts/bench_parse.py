@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Extracts the results of a benchmark from the UART log of `make bench`.
+
+Every line printed by the benchmark application that is a JSON object is
+a single result. The results are written to <prefix>.json, together with
+the exit status of the application, and to <prefix>.csv, one row per result.
+The script exits with 1 if the application failed or printed no results.
+"""
+
+import csv
+import json
+import re
+import sys
+
+
+def parse_log(path):
+    results, status, running = [], None, False
+    with open(path, errors="replace") as log:
+        for line in log:
+            # the UART log also contains the echoed commands and \r
+            line = line.strip()
+            if line == "BENCH_START":
+                running = True
+                continue
+            if not running:
+                continue
+            match = re.fullmatch(r"BENCH_EXIT=(\d+)", line)
+            if match:
+                status = int(match.group(1))
+                break
+            if line.startswith("{"):
+                try:
+                    results.append(json.loads(line))
+                except ValueError:
+                    pass
+    return results, status
+
+
+def main():
+    if len(sys.argv) != 4:
+        print("usage: %s <uart_log> <driver> <results_prefix>" % sys.argv[0])
+        return 1
+    log, driver, prefix = sys.argv[1:]
+
+    results, status = parse_log(log)
+
+    with open(prefix + ".json", "w") as out:
+        json.dump({"driver": driver, "exit_status": status,
+                   "results": results}, out, indent=2)
+
+    fields = []
+    for result in results:
+        fields += [key for key in result if key not in fields]
+    with open(prefix + ".csv", "w", newline="") as out:
+        writer = csv.DictWriter(out, fieldnames=fields)
+        writer.writeheader()
+        writer.writerows(results)
+
+    print("%s: %d results, exit status %s -> %s.{json,csv}" %
+          (driver, len(results), status, prefix))
+    return 0 if status == 0 and results else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
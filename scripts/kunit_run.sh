@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Run KUnit suites built as modules on the build host, using User Mode Linux.
+# usage: kunit_run.sh <uml kernel> <suite.ko>...
+#
+# The UML kernel boots with the host's root filesystem mounted read-only
+# through hostfs, so the init script below is run by the host's shell and the
+# modules are loaded with the host's insmod. Every module runs its suites
+# while it's being loaded. The KUnit results (TAP) are printed, and the exit
+# status is non-zero if any test case failed or no results were printed.
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <uml kernel> <suite.ko>..." >&2
+	exit 1
+fi
+
+UML=$1
+shift
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/init" <<INIT
+#!/bin/sh
+mount -t proc proc /proc
+for ko in $(realpath "$@"); do
+	insmod \$ko
+done
+echo o > /proc/sysrq-trigger
+INIT
+chmod 755 "$TMP/init"
+
+"$UML" mem=128M rootfstype=hostfs rootflags=/ ro init="$TMP/init" \
+	< /dev/null > "$TMP/console.log" 2>&1
+
+# drop the printk timestamps, if enabled, and keep the TAP lines only
+sed -e 's/^\[ *[0-9.]*\] //' "$TMP/console.log" |
+	grep -E '^ *(TAP version|[0-9]+\.\.[0-9]+|ok |not ok |# )'
+
+if grep -q 'not ok ' "$TMP/console.log" ||
+   ! grep -q 'ok ' "$TMP/console.log"; then
+	echo "KUnit: FAILED, the end of the console log:" >&2
+	tail -n 40 "$TMP/console.log" >&2
+	exit 1
+fi
+echo "KUnit: all tests passed"